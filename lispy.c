@@ -1,6 +1,26 @@
 #include "mpc.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <math.h>
+#include <errno.h>
+
+/* files are mapped into memory where the system can do it */
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* vector instructions for the array kernels, when the compiler targets them */
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 /* Use this command to compile:
 cc -std=c99 -Wall lispy.c mpc.c -ledit -lm -o lispy */
@@ -37,22 +57,23 @@ void add_history(char* unused) {}
 # include <readline/history.h>
 #endif
 
-/* function to execute power operations */
+/* function to execute power operations, by squaring. Negative powers are
+   truncated like integer division, 0 to one of them is left to the caller */
 long power(long x, long y) {
-    int total;
-    if (y == 0) { return 1; }
-    else if (y == 1) { return x; }
-    else if (y == -1) { return 1 / x; }
-    else if (y > 0) {
-        total = x;
-        total *= power(x, y - 1);
-    }
-    else {
-        total = 1 / x;
-        total *= power(x, y + 1);
+    if (y < 0) {
+        if (x == 1) { return 1; }
+        if (x == -1) { return (y % 2) ? -1 : 1; }
+        return 0;
     }
 
-    return total;
+    /* wrap around on overflow instead of being undefined */
+    unsigned long total = 1, base = x;
+    while (y) {
+        if (y & 1) { total *= base; }
+        base *= base;
+        y >>= 1;
+    }
+    return (long)total;
 }
 
 /* Builtins macros for error checking reporting */
@@ -70,8 +91,17 @@ long power(long x, long y) {
     "Function '%s' passed incorrect number of arguments. Got %i, Expected %i.", \
     func, args->count, num)
 
+#define LASSERT_SEQ(func, args, index) \
+  LASSERT(args, (args->cell[index]->type == LVAL_QEXPR) | (args->cell[index]->type == LVAL_VEC), \
+    "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s or %s.", \
+    func, index, ltype_name(args->cell[index]->type), ltype_name(LVAL_QEXPR), ltype_name(LVAL_VEC))
+
+#define LASSERT_KEY(func, args, index, hash) \
+  LASSERT(args, lhash_key(args->cell[index], &hash), \
+    "Function '%s' cannot use %s as a key.", func, ltype_name(args->cell[index]->type))
+
 #define LASSERT_NOT_EMPTY(func, args, index) \
-  LASSERT(args, args->cell[index]->count != 0, \
+  LASSERT(args, !lval_empty(args->cell[index]), \
     "Function '%s' passed {} for argument %i.", func, index);
 
 /* Input command for interpreter */
@@ -85,8 +115,10 @@ void cleanup() {
 /* forward declaration for the compiler */
 struct lval;
 struct lenv;
+struct lcode;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lcode lcode;
 
 /* Parser Declariations */
 lenv* lenv_new(void);
@@ -98,167 +130,605 @@ mpc_parser_t* Sexpr;
 mpc_parser_t* Qexpr;
 mpc_parser_t* Expr;
 mpc_parser_t* Lispy;
+mpc_parser_t* End;
+mpc_parser_t* Form;
+
+
+/* Symbol Table */
+
+
+/* every distinct symbol name is stored once and compared by pointer */
+struct {
+    int count;
+    int cap;
+    char** names;
+} symtab = { 0, 0, NULL };
+
+/* FNV-1a hash of a NUL terminated string */
+unsigned long lsym_hash(const char* s) {
+    unsigned long h = 2166136261UL;
+    while (*s) { h = (h ^ (unsigned char)*s++) * 16777619UL; }
+    return h;
+}
+
+/* double the table and reinsert every name */
+void lsym_grow(void) {
+    int old_cap = symtab.cap;
+    char** old = symtab.names;
+
+    symtab.cap = old_cap ? old_cap * 2 : 256;
+    symtab.names = calloc(symtab.cap, sizeof(char*));
+
+    for (int i = 0; i < old_cap; i++) {
+        if (!old[i]) { continue; }
+        unsigned long j = lsym_hash(old[i]) & (symtab.cap - 1);
+        while (symtab.names[j]) { j = (j + 1) & (symtab.cap - 1); }
+        symtab.names[j] = old[i];
+    }
+    free(old);
+}
+
+/* return the unique copy of a symbol name, adding it if new */
+char* lsym_intern(const char* s) {
+    /* keep the table at most two thirds full */
+    if ((symtab.count + 1) * 3 >= symtab.cap * 2) { lsym_grow(); }
+
+    unsigned long i = lsym_hash(s) & (symtab.cap - 1);
+    while (symtab.names[i]) {
+        if (strcmp(symtab.names[i], s) == 0) { return symtab.names[i]; }
+        i = (i + 1) & (symtab.cap - 1);
+    }
+
+    /* one flag byte is kept in front of the name, see LSYM_LOCAL */
+    char* name = malloc(strlen(s) + 2);
+    name[0] = 0;
+    strcpy(name + 1, s);
+
+    symtab.names[i] = name + 1;
+    symtab.count++;
+    return symtab.names[i];
+}
+
+/* set once a symbol has been bound anywhere but the global environment */
+#define LSYM_LOCAL(s) ((s)[-1])
+
+/* symbols the interpreter itself looks for */
+char* sym_amp;
 
 /* Create Enumeration of Possible lval Types */
-enum { LVAL_ERR, LVAL_LONG, LVAL_DOUBLE, LVAL_STR, LVAL_SYM, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR };
+enum { LVAL_ERR, LVAL_LONG, LVAL_DOUBLE, LVAL_STR, LVAL_SYM, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR,
+       LVAL_ARR, LVAL_VEC, LVAL_MAP, LVAL_SB, LVAL_FILE };
+
+/* element types of an array */
+enum { LARR_I64, LARR_F64 };
 
 /* create a function pointer type */
 typedef lval*(*lbuiltin)(lenv*, lval*);
 
+/* longest string kept inside the lval itself, the rest of a lambda's size */
+#define LSTR_INLINE (31)
+
+/* strings own their text, inline or on the heap, look into the text of another
+   string, or are a whole file mapped into memory */
+enum { LSTR_OWN, LSTR_VIEW, LSTR_MAPPED };
+
+/* an open file shared by the handles that refer to it */
+typedef struct lfile {
+    int rc;
+    FILE* fp;
+    char* name;
+    int writing;
+    /* bytes read ahead are buf[start..end), 'eof' once fread has returned nothing */
+    char* buf;
+    size_t cap, start, end;
+    int eof;
+} lfile;
+
+/* entries of a hash map, an empty slot has no key */
+typedef struct lslot { uint64_t hash; struct lval* key; struct lval* val; } lslot;
+
 /* our basic data structures, used for numbers, errors and expressions */
 typedef struct lval {
     int type;
-    long num;
-    double dec;
-    /* Error and Symbol types have some string data */
-    char* err;
-    char* str;
-    char* sym;
-    /* function type */
-    lbuiltin builtin;
-    /* container for lambda functions */
-    lenv* env;
-    lval* formals;
-    lval* body;
-    /* Count and Pointer to a list of "lval*" */
-    int count;
-    struct lval** cell;
+    /* number of owners, values are shared and copied only before a change */
+    int rc;
+    /* only the member for the type is used, and allocated, see lval_size */
+    union {
+        long num;
+        double dec;
+        /* Error and String types keep their length, short text is stored inline
+           and views keep the string that owns their text alive */
+        char* err;
+        struct { char* str; int len; int kind; union { char sbuf[LSTR_INLINE + 1]; struct lval* owner; }; };
+        /* Symbols cache where they were last found, as frame depth and slot */
+        struct { char* sym; int depth; int slot; };
+        /* Count and Pointer to a list of "lval*". Slices look at cells shared with
+           other lists, 'off' past the start of the array, which is -1 when they are owned */
+        struct { int count; int off; struct lval** cell; };
+        /* numeric arrays keep their elements unboxed and contiguous */
+        struct { int size; int elem; union { int64_t* i64; double* f64; }; };
+        /* vectors are a view of 'vcount' elements from 'vfirst' of a shared trie,
+           with 'tsize' slots in use and 'shift' bits of the position above the leaves */
+        struct { struct lvnode* trie; int shift; int tsize; int vfirst; int vcount; };
+        /* hash maps use open addressing over 'mcap' slots, a power of two */
+        struct { lslot* slots; int mcount; int mcap; };
+        /* string builders keep the strings appended to them until their text is asked for */
+        struct { int slen; int nparts; struct lval** parts; };
+        /* file handles share the file they refer to */
+        lfile* file;
+        /* function type, lambdas keep their body compiled once it has been run by
+           the vm. env is the frame of a call, args what a partial application was given */
+        struct { lbuiltin builtin; union { lenv* env; struct lval* args; };
+                 lval* formals; lval* body; lcode* code; int arity; int flags; };
+    };
 } lval;
 
+/* nodes of a vector trie, 32 slots chosen by 5 bits of the position at each level */
+#define LTRIE_BITS (5)
+#define LTRIE_WIDTH (1 << LTRIE_BITS)
+#define LTRIE_MASK (LTRIE_WIDTH - 1)
+
+typedef struct lvnode {
+    int rc;
+    union {
+        struct lvnode* kids[LTRIE_WIDTH];
+        lval* vals[LTRIE_WIDTH];
+    };
+} lvnode;
+
+/* lambdas: formals end with '& rest' or misuse '&', and what env holds if anything */
+enum { LFUN_REST = 1, LFUN_BADREST = 2, LFUN_BOUND = 4, LFUN_PARTIAL = 8 };
+
+/* instructions and constants for the vm, shared by the copies of a lambda */
+struct lcode {
+    int rc;
+    int count;
+    int cap;
+    int* ops;
+    int nconst;
+    int const_cap;
+    lval** consts;
+};
+
+/* set by the --vm option */
+int lvm_enabled = 0;
+
+/* set by the --lispy-lists option */
+int lispy_lists = 0;
+
+/* size classes of lval, numbers take less than half of a lambda,
+   strings are medium sized unless their text is inline */
+enum { LVAL_SMALL, LVAL_MEDIUM, LVAL_LARGE, LVAL_SIZES };
+
+int lval_size_class(int type) {
+    switch (type) {
+        case LVAL_LONG:
+        case LVAL_DOUBLE: return LVAL_SMALL;
+        case LVAL_SYM:
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+        case LVAL_ARR:
+        case LVAL_MAP:
+        case LVAL_SB:
+        case LVAL_FILE: return LVAL_MEDIUM;
+        default: return LVAL_LARGE;
+    }
+}
+
+/* size class of an existing lval */
+int lval_class_of(lval* v) {
+    if ((v->type == LVAL_STR) | (v->type == LVAL_ERR)) {
+        if (v->kind == LSTR_VIEW) { return LVAL_LARGE; }
+        if (v->kind == LSTR_MAPPED) { return LVAL_MEDIUM; }
+        return v->len <= LSTR_INLINE ? LVAL_LARGE : LVAL_MEDIUM;
+    }
+    return lval_size_class(v->type);
+}
+
+/* bytes needed by an lval of each size class */
+size_t lval_size(int class) {
+    switch (class) {
+        case LVAL_SMALL: return offsetof(lval, num) + sizeof(long);
+        case LVAL_MEDIUM: return offsetof(lval, cell) + sizeof(lval**);
+        default: return sizeof(lval);
+    }
+}
+
+/* lvals and lenvs are carved out of slabs and recycled through free lists */
+#define LPOOL_SLAB (256)
+
+/* cell arrays of up to 2^(LCELL_CLASSES-1) elements are pooled by size class */
+#define LCELL_CLASSES (7)
+
+typedef struct lpool {
+    /* free objects, linked through their first word */
+    void* free;
+    /* statistics: objects handed out and calls made to malloc */
+    long requests;
+    long mallocs;
+} lpool;
+
+lpool lval_pool[LVAL_SIZES], lenv_pool, lcell_pool[LCELL_CLASSES], lcell_large;
+
+/* take an object of 'size' bytes from a pool, adding a slab when empty */
+void* lpool_alloc(lpool* p, size_t size) {
+    p->requests++;
+    if (!p->free) {
+        char* slab = malloc(size * LPOOL_SLAB);
+        p->mallocs++;
+        for (int i = LPOOL_SLAB - 1; i >= 0; i--) {
+            *(void**)(slab + size * i) = p->free;
+            p->free = slab + size * i;
+        }
+    }
+    void* x = p->free;
+    p->free = *(void**)x;
+    return x;
+}
+
+/* give an object back to its pool */
+void lpool_free(lpool* p, void* x) {
+    *(void**)x = p->free;
+    p->free = x;
+}
+
+/* cell arrays keep a header before the first cell with their capacity and, once
+   they are shared by slices, how many slices there are and how many cells they hold */
+typedef struct { size_t cap; int rc; int used; } lcellhdr;
+
+lcellhdr* lcell_hdr(lval** cell) {
+    return (lcellhdr*)cell - 1;
+}
+
+size_t lcell_cap(lval** cell) {
+    return cell ? lcell_hdr(cell)->cap : 0;
+}
+
+/* allocate room for at least 'n' cells */
+lval** lcell_alloc(size_t n) {
+    if (n == 0) { return NULL; }
+
+    lcellhdr* block;
+    size_t cap = 1;
+    int k = 0;
+    while (cap < n) { cap *= 2; k++; }
+
+    if (k < LCELL_CLASSES) {
+        block = lpool_alloc(&lcell_pool[k], sizeof(lcellhdr) + sizeof(lval*) * cap);
+    } else {
+        cap = n;
+        block = malloc(sizeof(lcellhdr) + sizeof(lval*) * cap);
+        lcell_large.requests++;
+        lcell_large.mallocs++;
+    }
+    block->cap = cap;
+    return (lval**)(block + 1);
+}
+
+/* release a cell array to its size class */
+void lcell_free(lval** cell) {
+    if (!cell) { return; }
+
+    lcellhdr* block = lcell_hdr(cell);
+    size_t cap = block->cap;
+    int k = 0;
+    while ((size_t)1 << k < cap) { k++; }
+
+    if (k < LCELL_CLASSES && (size_t)1 << k == cap) {
+        lpool_free(&lcell_pool[k], block);
+    } else {
+        free(block);
+    }
+}
+
+/* grow a cell array geometrically, keeping its first 'count' cells */
+lval** lcell_grow(lval** cell, size_t count) {
+    size_t cap = lcell_cap(cell);
+    lval** x = lcell_alloc(cap ? cap * 2 : 1);
+    if (count) { memcpy(x, cell, sizeof(lval*) * count); }
+    lcell_free(cell);
+    return x;
+}
+
+/* Dead lvals are not released at once but queued and reclaimed a little
+   at a time, so dropping a huge list never stalls the interpreter */
+struct {
+    /* stack of lvals whose last reference is gone */
+    int count;
+    int cap;
+    lval** dead;
+    /* tunables: objects reclaimed per allocation and most left pending */
+    int budget;
+    int limit;
+    /* statistics */
+    long reclaimed;
+    int peak;
+} lgc = { 0, 0, NULL, 32, 1 << 16, 0, 0 };
+
+void lgc_step(int budget);
+
+/* allocate an lval of a size class with a single owner */
+lval* lval_alloc(int type, int class) {
+    /* pay back some pending reclamation for every allocation */
+    if (lgc.count) { lgc_step(lgc.count > lgc.limit ? lgc.count : lgc.budget); }
+
+    lval* v = lpool_alloc(&lval_pool[class], lval_size(class));
+    v->type = type;
+    v->rc = 1;
+    return v;
+}
+
+/* allocate an lval with a single owner */
+lval* lval_new(int type) {
+    return lval_alloc(type, lval_size_class(type));
+}
+
+/* Construct a String or Error lval with room for 'len' bytes of text */
+lval* lval_text_new(int type, int len) {
+    int in_place = len <= LSTR_INLINE;
+    lval* v = lval_alloc(type, in_place ? LVAL_LARGE : LVAL_MEDIUM);
+    v->len = len;
+    v->kind = LSTR_OWN;
+    v->str = in_place ? v->sbuf : malloc(len + 1);
+    /* keep a terminator so the text can still be passed to C functions */
+    v->str[len] = '\0';
+    return v;
+}
+
+/* Construct a String or Error lval from 'len' bytes, which may include NUL */
+lval* lval_text(int type, const char* s, int len) {
+    lval* v = lval_text_new(type, len);
+    memcpy(v->str, s, len);
+    return v;
+}
+
+/* small integers are preallocated and shared, they never reach a zero count */
+#define LFIX_MIN (-128)
+#define LFIX_MAX (1023)
+lval lfix[LFIX_MAX - LFIX_MIN + 1];
+
+void lfix_init(void) {
+    for (long i = LFIX_MIN; i <= LFIX_MAX; i++) {
+        lval* v = &lfix[i - LFIX_MIN];
+        v->type = LVAL_LONG;
+        v->rc = INT_MAX / 2;
+        v->num = i;
+    }
+}
+
 /* Construct a pointer to a new integer type lval */
 lval* lval_long(long x) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_LONG;
+    if (x >= LFIX_MIN && x <= LFIX_MAX) {
+        lval* v = &lfix[x - LFIX_MIN];
+        v->rc++;
+        return v;
+    }
+    lval* v = lval_new(LVAL_LONG);
     v->num = x;
-    v->dec = x;
     return v;
 }
 
 /* Create  a pointer to a new decimal type lval */
 lval* lval_double(double x) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_DOUBLE;
+    lval* v = lval_new(LVAL_DOUBLE);
     v->dec = x;
     return v;
 }
 
 /* Construct a pointer to a new Error lval */
 lval* lval_err(char* fmt, ...) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_ERR;
+    char err[BUFFER];
 
     /* Create a va list and initialize it */
     va_list va;
     va_start(va, fmt);
 
-    /* Allocate 512 bytes of space */
-    v->err = malloc(BUFFER);
-
     /* printf the error string with a maximum of 511 characters */
-    vsnprintf(v->err, BUFFER-1, fmt, va);
-
-    /* Reallocate to number of bytes actually used */
-    v->err = realloc(v->err, strlen(v->err)+1);
+    vsnprintf(err, BUFFER-1, fmt, va);
 
     /* Cleanup our va list */
     va_end(va);
 
-    return v;
+    return lval_text(LVAL_ERR, err, strlen(err));
 }
 
 /* Construct a pointer to a new String lval */
 lval* lval_str(char* s) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_STR;
-    v->str = malloc(strlen(s) + 1);
-    strcpy(v->str, s);
-    return v;
+    return lval_text(LVAL_STR, s, strlen(s));
 }
 
-/* Construct a pointer to a new Symbol lval */
+/* Construct a pointer to a new Symbol lval, the name is interned */
 lval* lval_sym(char* s) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_SYM;
-    v->sym = malloc(strlen(s) + 1);
-    strcpy(v->sym, s);
+    lval* v = lval_new(LVAL_SYM);
+    v->sym = lsym_intern(s);
+    v->depth = -1;
+    v->slot = -1;
     return v;
 }
 
 /* Construct a pointer to a new function lval */
 lval* lval_fun(lbuiltin func) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
+    lval* v = lval_new(LVAL_FUN);
     v->builtin = func;
     return v;
 }
 
+/* A pointer to a new array of 'size' elements, which are left uninitialised */
+lval* lval_array(int elem, int size) {
+    lval* v = lval_new(LVAL_ARR);
+    v->elem = elem;
+    v->size = size;
+    /* both element types take 8 bytes */
+    v->f64 = size ? malloc(sizeof(double) * size) : NULL;
+    return v;
+}
+
+/* element 'i' of an array as a decimal */
+double larr_double(lval* v, int i) {
+    return v->elem == LARR_I64 ? (double)v->i64[i] : v->f64[i];
+}
+
 /* A pointer to a new empty Sexpr lval */
 lval* lval_sexpr(void) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_SEXPR;
+    lval* v = lval_new(LVAL_SEXPR);
     v->count = 0;
+    v->off = -1;
     v->cell = NULL;
     return v;
 }
 
 /* A pointer to a new empty Qexpr lval */
 lval* lval_qexpr(void) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_QEXPR;
+    lval* v = lval_new(LVAL_QEXPR);
     v->count = 0;
+    v->off = -1;
     v->cell = NULL;
     return v;
 }
 
 /* forward declaration for the compiler */
+void lcode_del(lcode* c);
 void lenv_del(lenv* e);
 lenv* lenv_copy(lenv* e);
 void lenv_put(lenv* e, lval* k, lval* v);
+lenv* lenv_root(lenv* e);
+int lenv_find(lenv* e, char* sym);
+void lvnode_del(lvnode* n, int shift);
+void lfile_del(lfile* f);
+void lstr_unmap(char* text, int len);
+
+/* return the memory of a dead lval to the pool of its size */
+void lval_free(lval* v) {
+    lpool_free(&lval_pool[lval_class_of(v)], v);
+    lgc.reclaimed++;
+}
 
-/* delete a lval and all its content */
+/* drop a reference, queueing the lval for reclamation with the last one */
 void lval_del(lval* v) {
+    if (--v->rc > 0) { return; }
 
+    /* Values without children are freed straight away */
     switch (v->type) {
-        case LVAL_LONG: break;
-        case LVAL_DOUBLE: break;
-
-        /* Clear lambda functions */
+        case LVAL_ERR:
+        case LVAL_STR:
+            if (v->kind == LSTR_VIEW) { lval_del(v->owner); }
+            else if (v->kind == LSTR_MAPPED) { lstr_unmap(v->str, v->len); }
+            else if (v->str != v->sbuf) { free(v->str); }
+            lval_free(v); return;
+        case LVAL_LONG:
+        case LVAL_DOUBLE:
+        case LVAL_SYM:
+            lval_free(v); return;
+        case LVAL_ARR:
+            free(v->f64);
+            lval_free(v); return;
+        case LVAL_VEC:
+            lvnode_del(v->trie, v->shift);
+            lval_free(v); return;
+        case LVAL_FILE:
+            lfile_del(v->file);
+            lval_free(v); return;
         case LVAL_FUN:
-        if (!v->builtin) {
-            lenv_del(v->env);
-            lval_del(v->formals);
-            lval_del(v->body);
-        }
+            if (v->builtin) { lval_free(v); return; }
         break;
+    }
 
-        /* For Err, Str or Sym free the string data */
-        case LVAL_ERR: free(v->err); break;
-        case LVAL_SYM: free(v->sym); break;
-        case LVAL_STR: free(v->str); break;
+    if (lgc.count == lgc.cap) {
+        lgc.cap = lgc.cap ? lgc.cap * 2 : 256;
+        lgc.dead = realloc(lgc.dead, sizeof(lval*) * lgc.cap);
+    }
+    lgc.dead[lgc.count++] = v;
+    if (lgc.count > lgc.peak) { lgc.peak = lgc.count; }
+}
 
-        /* If Qexpr or Sexpr then delete all elements inside */
-        case LVAL_QEXPR:
-        case LVAL_SEXPR:
-            for (int i = 0; i < v->count; i++) {
-                lval_del(v->cell[i]);
+/* reclaim dead lvals doing at most 'budget' units of work */
+void lgc_step(int budget) {
+    while (lgc.count && budget > 0) {
+        lval* v = lgc.dead[lgc.count-1];
+
+        /* Lists give back their elements a few at a time */
+        if ((v->type == LVAL_QEXPR) | (v->type == LVAL_SEXPR)) {
+            /* slices leave the cells to the array, the last one releases all of them */
+            if (v->off >= 0) {
+                lval** cells = v->cell - v->off;
+                lcellhdr* h = lcell_hdr(cells);
+                v->off = -1;
+                if (--h->rc) {
+                    v->cell = NULL; v->count = 0;
+                } else {
+                    v->cell = cells; v->count = h->used;
+                }
             }
-            /* Also free the memory allocated to contain the pointers */
-            free(v->cell);
-        break;
+            while (v->count && budget > 0) {
+                lval_del(v->cell[--v->count]);
+                budget--;
+            }
+            /* elements may have been queued above this list */
+            if (v->count || lgc.dead[lgc.count-1] != v) { continue; }
+        }
+
+        lgc.count--;
+        switch (v->type) {
+            /* Clear lambda functions */
+            case LVAL_FUN:
+            if (!v->builtin) {
+                if (v->flags & LFUN_BOUND) { lenv_del(v->env); }
+                if (v->flags & LFUN_PARTIAL) { lval_del(v->args); }
+                lval_del(v->formals);
+                lval_del(v->body);
+                if (v->code) { lcode_del(v->code); }
+            }
+            break;
+
+            /* Hash maps release every entry */
+            case LVAL_MAP:
+                for (int i = 0; i < v->mcap; i++) {
+                    if (!v->slots[i].key) { continue; }
+                    lval_del(v->slots[i].key);
+                    lval_del(v->slots[i].val);
+                }
+                free(v->slots);
+            break;
+
+            case LVAL_SB:
+                for (int i = 0; i < v->nparts; i++) { lval_del(v->parts[i]); }
+                lcell_free(v->parts);
+            break;
+
+            /* Lists only have the memory for the pointers left */
+            case LVAL_QEXPR:
+            case LVAL_SEXPR: lcell_free(v->cell); break;
+        }
+
+        /* Give the memory for the "lval" struct itself back to the pool */
+        lval_free(v);
+        budget--;
     }
+}
 
-    /* Free the memory allocated for the "lval" struct itself */
-    free(v);
+/* reclaim everything that is pending */
+void lgc_collect(void) {
+    while (lgc.count) { lgc_step(lgc.count); }
 }
 
-/* create a copy of a lval */
+/* take another reference to a lval */
 lval* lval_copy(lval* v) {
+    v->rc++;
+    return v;
+}
+
+/* make a private copy of a lval, sharing everything below its top level */
+lval* lval_dup(lval* v) {
 
-    lval* x = malloc(sizeof(lval));
-    x->type = v->type;
+    /* Strings are sized by their text */
+    if ((v->type == LVAL_STR) | (v->type == LVAL_ERR)) {
+        return lval_text(v->type, v->str, v->len);
+    }
+
+    lval* x = lval_new(v->type);
 
     switch (v->type) {
-        case LVAL_LONG: x->num = v->num; x->dec = v->dec; break;
+        case LVAL_LONG: x->num = v->num; break;
         case LVAL_DOUBLE: x->dec = v->dec; break;
 
         /* Copy for builtin and lambda functions */
@@ -267,28 +737,75 @@ lval* lval_copy(lval* v) {
                 x->builtin = v->builtin;
             } else {
                 x->builtin = NULL;
-                x->env = lenv_copy(v->env);
+                x->env = NULL;
+                if (v->flags & LFUN_BOUND) { x->env = lenv_copy(v->env); }
+                if (v->flags & LFUN_PARTIAL) { x->args = lval_copy(v->args); }
                 x->formals = lval_copy(v->formals);
                 x->body = lval_copy(v->body);
+                x->code = v->code;
+                if (x->code) { x->code->rc++; }
+                x->arity = v->arity;
+                x->flags = v->flags;
             }
         break;
 
-        /* Copy Strings using malloc and strcpy */
-        case LVAL_ERR:
-            x->err = malloc(strlen(v->err) + 1);
-            strcpy(x->err, v->err); break;
         case LVAL_SYM:
-            x->sym = malloc(strlen(v->sym) + 1);
-            strcpy(x->sym, v->sym); break;
-        case LVAL_STR:
-            x->str = malloc(strlen(v->str) + 1);
-            strcpy(x->str, v->str); break;
+            x->sym = v->sym;
+            x->depth = v->depth;
+            x->slot = v->slot;
+        break;
+
+        case LVAL_ARR:
+            x->elem = v->elem;
+            x->size = v->size;
+            x->f64 = v->size ? malloc(sizeof(double) * v->size) : NULL;
+            if (v->size) { memcpy(x->f64, v->f64, sizeof(double) * v->size); }
+        break;
+
+        /* Vectors share their trie, it is copied a path at a time when changed */
+        case LVAL_VEC:
+            x->trie = v->trie;
+            if (x->trie) { x->trie->rc++; }
+            x->shift = v->shift;
+            x->tsize = v->tsize;
+            x->vfirst = v->vfirst;
+            x->vcount = v->vcount;
+        break;
+
+        /* Hash maps copy their slots, sharing the keys and values */
+        case LVAL_MAP:
+            x->mcount = v->mcount;
+            x->mcap = v->mcap;
+            x->slots = malloc(sizeof(lslot) * v->mcap);
+            memcpy(x->slots, v->slots, sizeof(lslot) * v->mcap);
+            for (int i = 0; i < x->mcap; i++) {
+                if (!x->slots[i].key) { continue; }
+                lval_copy(x->slots[i].key);
+                lval_copy(x->slots[i].val);
+            }
+        break;
 
-        /* Copy Lists by copying each sub-expression */
+        case LVAL_FILE:
+            x->file = v->file;
+            x->file->rc++;
+        break;
+
+        /* Builders share the strings appended to them */
+        case LVAL_SB:
+            x->slen = v->slen;
+            x->nparts = v->nparts;
+            x->parts = lcell_alloc(v->nparts);
+            for (int i = 0; i < x->nparts; i++) {
+                x->parts[i] = lval_copy(v->parts[i]);
+            }
+        break;
+
+        /* Copy Lists by referencing each sub-expression */
         case LVAL_SEXPR:
         case LVAL_QEXPR:
             x->count = v->count;
-            x->cell = malloc(sizeof(lval*) * x->count);
+            x->off = -1;
+            x->cell = lcell_alloc(x->count);
             for (int i = 0; i < x->count; i++) {
                 x->cell[i] = lval_copy(v->cell[i]);
             }
@@ -298,33 +815,86 @@ lval* lval_copy(lval* v) {
   return x;
 }
 
+/* true for lists looking at cells they share with other lists */
+int lval_is_slice(lval* v) {
+    return ((v->type == LVAL_QEXPR) | (v->type == LVAL_SEXPR)) && v->off >= 0;
+}
+
+/* return a lval the caller may change, copying it if it is shared */
+lval* lval_own(lval* v) {
+    if (v->rc == 1 && !lval_is_slice(v)) { return v; }
+    lval* x = lval_dup(v);
+    lval_del(v);
+    return x;
+}
+
+/* the text of 's' from 'i' up to 'j', long pieces are views of the text of 's'
+   rather than copies of it */
+lval* lval_substr(lval* s, int i, int j) {
+    if (j - i <= LSTR_INLINE) {
+        lval* x = lval_text(LVAL_STR, s->str + i, j - i);
+        lval_del(s); return x;
+    }
+    if (i == 0 && j == s->len) { return s; }
+
+    /* A view nobody else uses can simply be narrowed */
+    if (s->kind == LSTR_VIEW && s->rc == 1) {
+        s->str += i;
+        s->len = j - i;
+        return s;
+    }
+    lval* x = lval_alloc(LVAL_STR, LVAL_LARGE);
+    x->kind = LSTR_VIEW;
+    x->str = s->str + i;
+    x->len = j - i;
+    x->owner = s->kind == LSTR_VIEW ? lval_copy(s->owner) : s;
+    if (s->kind == LSTR_VIEW) { lval_del(s); }
+    return x;
+}
+
+/* a string that owns its text, so it no longer keeps a larger one alive */
+lval* lval_materialize(lval* s) {
+    if (s->kind == LSTR_OWN) { return s; }
+    lval* x = lval_text(LVAL_STR, s->str, s->len);
+    lval_del(s);
+    return x;
+}
+
 /* adds elements to a sexpr but also manages the number of cells and the memory */
 lval* lval_add(lval* v, lval* x) {
-    v->count++;
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-    v->cell[v->count-1] = x;
+    if ((size_t)v->count == lcell_cap(v->cell)) {
+        v->cell = lcell_grow(v->cell, v->count);
+    }
+    v->cell[v->count++] = x;
     return v;
 }
 
+/* forward declaration for the compiler */
+int lval_seq_count(lval* v);
+lval* lval_seq_get(lval* v, int i);
+lval* lval_vec_push(lval* v, lval* x);
+
 /* move the content of a qexpr into another qexpr */
 lval* lval_join(lval* x, lval* y) {
     /* For strings */
     if ((x->type == LVAL_STR) & (y->type == LVAL_STR)) {
-        char str[BUFFER];
-        strcpy(str, x->str);
-        strcat(str, y->str);
+        lval* v = lval_text_new(LVAL_STR, x->len + y->len);
+        memcpy(v->str, x->str, x->len);
+        memcpy(v->str + x->len, y->str, y->len);
 
         lval_del(x); lval_del(y);
-        return lval_str(str);
+        return v;
     }
 
-    /* For each cell in 'y' add it to 'x' */
-    for (int i = 0; i < y->count; i++) {
-        x = lval_add(x, y->cell[i]);
+    /* For each element of 'y' add it to 'x', lists and vectors mix */
+    x = lval_own(x);
+    for (int i = 0; i < lval_seq_count(y); i++) {
+        lval* e = lval_copy(lval_seq_get(y, i));
+        x = x->type == LVAL_VEC ? lval_vec_push(x, e) : lval_add(x, e);
     }
 
-    /* Delete the empty 'y' and return 'x' */
-    free(y->cell); free(y);
+    /* Delete 'y' and return 'x' */
+    lval_del(y);
     return x;
 }
 
@@ -337,140 +907,788 @@ lval* lval_pop(lval* v, int i) {
     memmove(&v->cell[i], &v->cell[i+1],
         sizeof(lval*) * (v->count-i-1));
 
-    /* Decrease the count of items in the list */
+    /* Decrease the count of items in the list, the space is kept for reuse */
     v->count--;
-
-    /* Reallocate the memory used */
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
     return x;
 }
 
 /* takes element from sexpr then deletes the rest of it */
 lval* lval_take(lval* v, int i) {
-    lval* x = lval_pop(v, i);
+    lval* x = v->cell[i];
+
+    /* If this is the last reference move the element out, otherwise share it */
+    if (v->rc == 1 && !lval_is_slice(v)) {
+        v->cell[i] = v->cell[--v->count];
+    } else {
+        lval_copy(x);
+    }
     lval_del(v);
     return x;
 }
 
+/* the cells from 'i' up to 'j' of a list, looking at them instead of copying */
+lval* lval_slice(lval* v, int i, int j) {
+    /* A list owning its cells gives them to the array, to be shared from then on */
+    if (v->off < 0) {
+        if (!v->cell) { return v; }
+        lcellhdr* h = lcell_hdr(v->cell);
+        h->rc = 1;
+        h->used = v->count;
+        v->off = 0;
+    }
 
-/* Lisp Environment */
+    lval* x = v;
+    if (v->rc > 1) {
+        x = lval_new(v->type);
+        x->count = v->count;
+        x->off = v->off;
+        x->cell = v->cell;
+        lcell_hdr(v->cell - v->off)->rc++;
+        lval_del(v);
+    }
+    x->cell += i;
+    x->off += i;
+    x->count = j - i;
+    return x;
+}
 
+/* Persistent vectors */
 
-/* define the environment struct */
-struct lenv {
-    lenv* par;
-    int count;
-    char** syms;
-    lval** vals;
-};
 
-/* create a new system environment */
-lenv* lenv_new(void) {
-    lenv* e = malloc(sizeof(lenv));
-    e->par = NULL;
-    e->count = 0;
-    e->syms = NULL;
-    e->vals = NULL;
-    return e;
+lvnode* lvnode_new(void) {
+    lvnode* n = calloc(1, sizeof(lvnode));
+    n->rc = 1;
+    return n;
 }
 
-/* Construct a pointer to a new lambda lval */
-lval* lval_lambda(lval* formals, lval* body) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
-    v->builtin = NULL;
-    v->env = lenv_new();
-    v->formals = formals;
-    v->body = body;
-    return v;
+/* drop a reference to a node 'shift' bits above the leaves */
+void lvnode_del(lvnode* n, int shift) {
+    if (!n || --n->rc > 0) { return; }
+    for (int i = 0; i < LTRIE_WIDTH; i++) {
+        if (shift) {
+            lvnode_del(n->kids[i], shift - LTRIE_BITS);
+        } else if (n->vals[i]) {
+            lval_del(n->vals[i]);
+        }
+    }
+    free(n);
 }
 
-/* delete an environment */
-void lenv_del(lenv* e) {
-    /* Iterate over all items in environment deleting them */
-    for (int i = 0; i < e->count; i++) {
-        free(e->syms[i]);
-        lval_del(e->vals[i]);
+/* return a node the caller may change, copying it if it is shared */
+lvnode* lvnode_own(lvnode* n, int shift) {
+    if (!n) { return lvnode_new(); }
+    if (n->rc == 1) { return n; }
+
+    lvnode* x = lvnode_new();
+    for (int i = 0; i < LTRIE_WIDTH; i++) {
+        if (shift) {
+            x->kids[i] = n->kids[i];
+            if (x->kids[i]) { x->kids[i]->rc++; }
+        } else if (n->vals[i]) {
+            x->vals[i] = lval_copy(n->vals[i]);
+        }
     }
-    /* Free allocated memory for lists */
-    free(e->syms);
-    free(e->vals);
-    free(e);
+    /* the caller's reference moves to the copy */
+    n->rc--;
+    return x;
 }
 
-/* lookup for a value in the environment */
-lval* lenv_get(lenv* e, lval* k) {
+/* store 'x' in slot 'k' below 'n', returning the node that replaces 'n' */
+lvnode* lvnode_set(lvnode* n, int shift, int k, lval* x) {
+    n = lvnode_own(n, shift);
+    if (shift == 0) {
+        if (n->vals[k & LTRIE_MASK]) { lval_del(n->vals[k & LTRIE_MASK]); }
+        n->vals[k & LTRIE_MASK] = x;
+    } else {
+        int i = (k >> shift) & LTRIE_MASK;
+        n->kids[i] = lvnode_set(n->kids[i], shift - LTRIE_BITS, k, x);
+    }
+    return n;
+}
 
-    /* Iterate over all items in environment */
-    for (int i = 0; i < e->count; i++) {
-        /* Check if the stored string matches the symbol string */
-        /* If it does, return a copy of the value */
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            return lval_copy(e->vals[i]);
-        }
+/* A pointer to a new empty Vector lval */
+lval* lval_vec(void) {
+    lval* v = lval_new(LVAL_VEC);
+    v->trie = NULL;
+    v->shift = 0;
+    v->tsize = 0;
+    v->vfirst = 0;
+    v->vcount = 0;
+    return v;
+}
+
+/* element 'i' of a vector, walking down one level per 5 bits of its position */
+lval* lval_vec_get(lval* v, int i) {
+    int k = v->vfirst + i;
+    lvnode* n = v->trie;
+    for (int s = v->shift; s > 0; s -= LTRIE_BITS) {
+        n = n->kids[(k >> s) & LTRIE_MASK];
     }
-    /* If no symbol check in parent otherwise error */
-    if (e->par) {
-        return lenv_get(e->par, k);
-    } else {
-        return lval_err("Unbound Symbol '%s'", k->sym);
+    return n->vals[k & LTRIE_MASK];
+}
+
+/* store 'x' in slot 'k' of a vector the caller owns, growing the trie if needed */
+void lval_vec_put(lval* v, int k, lval* x) {
+    while (k >= (LTRIE_WIDTH << v->shift)) {
+        lvnode* r = lvnode_new();
+        r->kids[0] = v->trie;
+        v->trie = r;
+        v->shift += LTRIE_BITS;
     }
+    v->trie = lvnode_set(v->trie, v->shift, k, x);
+    if (k >= v->tsize) { v->tsize = k + 1; }
 }
 
-void lenv_def(lenv* e, lval* k, lval* v) {
-    /* Iterate till e has no parent */
-    while (e->par) { e = e->par; }
-    /* Put value in e */
-    lenv_put(e, k, v);
+/* replace element 'i' of a vector with 'x' */
+lval* lval_vec_set(lval* v, int i, lval* x) {
+    v = lval_own(v);
+    lval_vec_put(v, v->vfirst + i, x);
+    return v;
 }
 
-/* Insert a new value in the environment */
-void lenv_put(lenv* e, lval* k, lval* v) {
+/* add 'x' at the end of a vector */
+lval* lval_vec_push(lval* v, lval* x) {
+    v = lval_own(v);
+    lval_vec_put(v, v->vfirst + v->vcount, x);
+    v->vcount++;
+    return v;
+}
 
-    /* Iterate over all items in environment to see if variable exists */
-    for (int i = 0; i < e->count; i++) {
+/* add 'x' at the front of a vector */
+lval* lval_vec_cons(lval* x, lval* v) {
+    v = lval_own(v);
 
-        /* If variable is found delete it and replace it with new var */
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            return;
+    /* Without a free slot in front move the elements up, leaving as much room as there are of them */
+    if (v->vfirst == 0) {
+        int room = v->vcount > LTRIE_WIDTH ? v->vcount : LTRIE_WIDTH;
+        lval* w = lval_vec();
+        for (int i = 0; i < v->vcount; i++) {
+            lval_vec_put(w, room + i, lval_copy(lval_vec_get(v, i)));
         }
+        w->vfirst = room;
+        w->vcount = v->vcount;
+        lval_del(v);
+        v = w;
     }
 
-    /* If no existing entry found allocate space for new entry */
-    e->count++;
-    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
-
-    /* Copy contents of lval and symbol string into new location */
-    e->vals[e->count-1] = lval_copy(v);
-    e->syms[e->count-1] = malloc(strlen(k->sym)+1);
-    strcpy(e->syms[e->count-1], k->sym);
+    v->vfirst--;
+    v->vcount++;
+    lval_vec_put(v, v->vfirst, x);
+    return v;
 }
 
-/* copy an environment */
-lenv* lenv_copy(lenv* e) {
-    lenv* n = malloc(sizeof(lenv));
-    n->par = e->par;
-    n->count = e->count;
-    n->syms = malloc(sizeof(char*) * n->count);
-    n->vals = malloc(sizeof(lval*) * n->count);
+/* the elements from 'i' up to 'j' of a vector, sharing its trie */
+lval* lval_vec_slice(lval* v, int i, int j) {
+    v = lval_own(v);
+    v->vfirst += i;
+    v->vcount = j - i;
+    return v;
+}
 
-    /* copy all the variables inside */
-    for (int i = 0; i < e->count; i++) {
-        n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-        strcpy(n->syms[i], e->syms[i]);
-        n->vals[i] = lval_copy(e->vals[i]);
+/* a vector of the elements of a Q-Expression */
+lval* lval_vec_from_list(lval* l) {
+    lval* v = lval_vec();
+    for (int i = 0; i < l->count; i++) {
+        lval_vec_put(v, i, lval_copy(l->cell[i]));
     }
-    return n;
+    v->vcount = l->count;
+    return v;
 }
 
+/* a Q-Expression of the elements of a vector */
+lval* lval_vec_to_list(lval* v) {
+    lval* x = lval_qexpr();
+    x->count = v->vcount;
+    x->cell = lcell_alloc(v->vcount);
+    for (int i = 0; i < v->vcount; i++) {
+        x->cell[i] = lval_copy(lval_vec_get(v, i));
+    }
+    return x;
+}
 
-/* Read and print lvals */
+/* number of elements in a Q-Expression or a vector */
+int lval_seq_count(lval* v) {
+    return v->type == LVAL_VEC ? v->vcount : v->count;
+}
 
+/* element 'i' of a Q-Expression or a vector */
+lval* lval_seq_get(lval* v, int i) {
+    return v->type == LVAL_VEC ? lval_vec_get(v, i) : v->cell[i];
+}
 
-/* list of types to use in error reporting */
+/* true for empty strings, lists and vectors */
+int lval_empty(lval* v) {
+    switch (v->type) {
+        case LVAL_STR: return v->len == 0;
+        case LVAL_VEC: return v->vcount == 0;
+        case LVAL_MAP: return v->mcount == 0;
+        case LVAL_SB: return v->slen == 0;
+        case LVAL_ARR: return v->size == 0;
+        default: return v->count == 0;
+    }
+}
+
+/* Hash maps */
+
+
+/* forward declaration for the compiler */
+int lval_eq(lval* x, lval* y);
+
+/* FNV-1a over the bytes of a string */
+uint64_t lhash_bytes(char* s, int n) {
+    uint64_t h = 14695981039346656037ULL;
+    for (int i = 0; i < n; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* spread the bits of a 64 bit integer over all of them */
+uint64_t lhash_mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/* hash of a key, 0 if the value cannot be one. Integers and decimals that
+   are equal hash the same, as they are equal for lval_eq */
+int lhash_key(lval* k, uint64_t* h) {
+    switch (k->type) {
+        case LVAL_STR: *h = lhash_bytes(k->str, k->len); return 1;
+        case LVAL_SYM: *h = lhash_mix(lhash_bytes(k->sym, strlen(k->sym))); return 1;
+        case LVAL_LONG: *h = lhash_mix((uint64_t)k->num); return 1;
+        case LVAL_DOUBLE:
+            /* only doubles in the range of a long can be converted to one */
+            if (k->dec >= (double)LONG_MIN && k->dec < -(double)LONG_MIN &&
+                k->dec == (double)(long)k->dec) {
+                *h = lhash_mix((uint64_t)(long)k->dec);
+            } else {
+                uint64_t bits;
+                memcpy(&bits, &k->dec, sizeof(bits));
+                *h = lhash_mix(bits);
+            }
+            return 1;
+    }
+    return 0;
+}
+
+/* A pointer to a new empty hash map */
+lval* lval_map(void) {
+    lval* m = lval_new(LVAL_MAP);
+    m->mcap = 8;
+    m->mcount = 0;
+    m->slots = calloc(m->mcap, sizeof(lslot));
+    return m;
+}
+
+/* the slot holding key 'k', or the empty slot where it belongs */
+int lmap_find(lval* m, lval* k, uint64_t h) {
+    int mask = m->mcap - 1;
+    for (int i = h & mask;; i = (i + 1) & mask) {
+        lslot* s = &m->slots[i];
+        if (!s->key || (s->hash == h && lval_eq(s->key, k))) { return i; }
+    }
+}
+
+/* double the slots, placing the entries again by their saved hash */
+void lmap_grow(lval* m) {
+    lslot* old = m->slots;
+    int cap = m->mcap;
+    m->mcap *= 2;
+    m->slots = calloc(m->mcap, sizeof(lslot));
+    for (int i = 0; i < cap; i++) {
+        if (!old[i].key) { continue; }
+        int j = old[i].hash & (m->mcap - 1);
+        while (m->slots[j].key) { j = (j + 1) & (m->mcap - 1); }
+        m->slots[j] = old[i];
+    }
+    free(old);
+}
+
+/* bind 'k' to 'v', taking both */
+void lmap_put(lval* m, lval* k, lval* v, uint64_t h) {
+    if ((m->mcount + 1) * 4 > m->mcap * 3) { lmap_grow(m); }
+    lslot* s = &m->slots[lmap_find(m, k, h)];
+    if (s->key) {
+        lval_del(k);
+        lval_del(s->val);
+    } else {
+        s->key = k;
+        s->hash = h;
+        m->mcount++;
+    }
+    s->val = v;
+}
+
+/* remove the entry in slot 'i', moving back the entries probed past it */
+void lmap_remove(lval* m, int i) {
+    int mask = m->mcap - 1;
+    lval_del(m->slots[i].key);
+    lval_del(m->slots[i].val);
+    m->mcount--;
+
+    for (int j = (i + 1) & mask; m->slots[j].key; j = (j + 1) & mask) {
+        int home = m->slots[j].hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            m->slots[i] = m->slots[j];
+            i = j;
+        }
+    }
+    m->slots[i].key = NULL;
+    m->slots[i].val = NULL;
+}
+
+/* String builders */
+
+
+/* A pointer to a new empty string builder */
+lval* lval_sb(void) {
+    lval* b = lval_new(LVAL_SB);
+    b->slen = 0;
+    b->nparts = 0;
+    b->parts = NULL;
+    return b;
+}
+
+/* append a string to a builder by keeping a reference to it, taking 's' */
+void lval_sb_add(lval* b, lval* s) {
+    if (s->len == 0) { lval_del(s); return; }
+    if ((size_t)b->nparts == lcell_cap(b->parts)) {
+        b->parts = lcell_grow(b->parts, b->nparts);
+    }
+    b->parts[b->nparts++] = s;
+    b->slen += s->len;
+}
+
+/* the text of a builder as one string, which then replaces its parts */
+lval* lval_sb_str(lval* b) {
+    if (b->nparts == 1) { return lval_copy(b->parts[0]); }
+
+    lval* s = lval_text_new(LVAL_STR, b->slen);
+    for (int i = 0, at = 0; i < b->nparts; i++) {
+        memcpy(s->str + at, b->parts[i]->str, b->parts[i]->len);
+        at += b->parts[i]->len;
+        lval_del(b->parts[i]);
+    }
+    b->nparts = 0;
+    b->slen = 0;
+    lval_sb_add(b, lval_copy(s));
+    return s;
+}
+
+/* File handles */
+
+
+/* reads go through a buffer of this size at least, grown for longer lines */
+#define LFILE_BUFFER (1 << 16)
+
+/* A pointer to a new handle for a file opened with 'mode' */
+lval* lval_file(FILE* fp, char* name, int writing) {
+    lfile* f = malloc(sizeof(lfile));
+    f->rc = 1;
+    f->fp = fp;
+    f->name = malloc(strlen(name) + 1);
+    strcpy(f->name, name);
+    f->writing = writing;
+    f->buf = NULL;
+    f->cap = f->start = f->end = 0;
+    f->eof = 0;
+    if (writing) { setvbuf(fp, NULL, _IOFBF, LFILE_BUFFER); }
+
+    lval* v = lval_new(LVAL_FILE);
+    v->file = f;
+    return v;
+}
+
+/* close the file, further reads and writes give an error */
+void lfile_close(lfile* f) {
+    if (f->fp) { fclose(f->fp); }
+    f->fp = NULL;
+}
+
+/* drop a reference to a file, closing it with the last */
+void lfile_del(lfile* f) {
+    if (--f->rc > 0) { return; }
+    lfile_close(f);
+    free(f->buf);
+    free(f->name);
+    free(f);
+}
+
+/* read more of the file after what is buffered, returns 0 at its end */
+int lfile_fill(lfile* f) {
+    if (f->eof) { return 0; }
+
+    /* Move what is left to the front, the buffer only grows when that is all of it */
+    if (f->start) {
+        memmove(f->buf, f->buf + f->start, f->end - f->start);
+        f->end -= f->start;
+        f->start = 0;
+    }
+    if (f->end == f->cap) {
+        f->cap = f->cap ? f->cap * 2 : LFILE_BUFFER;
+        f->buf = realloc(f->buf, f->cap);
+    }
+
+    size_t n = fread(f->buf + f->end, 1, f->cap - f->end, f->fp);
+    if (n == 0) { f->eof = 1; return 0; }
+    f->end += n;
+    return 1;
+}
+
+/* the next line without its newline, or NULL at the end of the file */
+lval* lfile_line(lfile* f) {
+    size_t seen = 0;
+    for (;;) {
+        char* at = f->buf + f->start;
+        size_t left = f->end - f->start - seen;
+        char* nl = left ? memchr(at + seen, '\n', left) : NULL;
+        if (nl) {
+            lval* s = lval_text(LVAL_STR, at, nl - at);
+            f->start += nl - at + 1;
+            return s;
+        }
+        seen = f->end - f->start;
+        if (!lfile_fill(f)) { break; }
+    }
+
+    /* The last line may have no newline */
+    if (f->start == f->end) { return NULL; }
+    lval* s = lval_text(LVAL_STR, f->buf + f->start, f->end - f->start);
+    f->start = f->end;
+    return s;
+}
+
+/* up to 'n' bytes, or NULL at the end of the file */
+lval* lfile_chunk(lfile* f, size_t n) {
+    while (f->end - f->start < n && lfile_fill(f)) {}
+    if (f->start == f->end) { return NULL; }
+    if (n > f->end - f->start) { n = f->end - f->start; }
+    lval* s = lval_text(LVAL_STR, f->buf + f->start, n);
+    f->start += n;
+    return s;
+}
+
+/* a whole file as a String, mapped into memory rather than read and copied.
+   NULL with errno set if it can't be opened */
+lval* lval_mapped(char* name) {
+#ifndef _WIN32
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) { return NULL; }
+    struct stat st;
+    if (fstat(fd, &st) < 0) { close(fd); return NULL; }
+    /* String lengths are ints, a bigger file can't be one string */
+    if (st.st_size > INT_MAX) { close(fd); errno = EFBIG; return NULL; }
+    if (st.st_size == 0) { close(fd); return lval_str(""); }
+
+    char* text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED) { return NULL; }
+
+    /* Text that fits inline isn't worth a mapping */
+    if (st.st_size <= LSTR_INLINE) {
+        lval* x = lval_text(LVAL_STR, text, st.st_size);
+        munmap(text, st.st_size);
+        return x;
+    }
+    lval* x = lval_alloc(LVAL_STR, LVAL_MEDIUM);
+    x->kind = LSTR_MAPPED;
+    x->str = text;
+    x->len = st.st_size;
+    return x;
+#else
+    /* without mmap the file is read into an ordinary string */
+    FILE* fp = fopen(name, "rb");
+    if (!fp) { return NULL; }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    if (size > INT_MAX) { fclose(fp); errno = EFBIG; return NULL; }
+    rewind(fp);
+    lval* x = lval_text_new(LVAL_STR, size);
+    x->len = fread(x->str, 1, size, fp);
+    x->str[x->len] = '\0';
+    fclose(fp);
+    return x;
+#endif
+}
+
+/* give back the memory of a mapped file */
+void lstr_unmap(char* text, int len) {
+#ifndef _WIN32
+    munmap(text, len);
+#endif
+}
+
+
+/* Lisp Environment */
+
+
+/* frames up to this size keep their bindings inside the struct */
+#define LENV_INLINE (8)
+
+/* define the environment struct, syms point into the symbol table */
+struct lenv {
+    lenv* par;
+    /* outermost environment, kept so globals are found without walking up */
+    lenv* root;
+    int count;
+    int cap;
+    char** syms;
+    lval** vals;
+    /* open addressing index of slot+1 (0 is empty) used once the frame is large */
+    int* index;
+    int index_cap;
+    /* inline storage for small frames such as lambda calls */
+    char* isyms[LENV_INLINE];
+    lval* ivals[LENV_INLINE];
+};
+
+/* create a new system environment */
+lenv* lenv_new(void) {
+    lenv* e = lpool_alloc(&lenv_pool, sizeof(lenv));
+    e->par = NULL;
+    e->root = e;
+    e->count = 0;
+    e->cap = LENV_INLINE;
+    e->syms = e->isyms;
+    e->vals = e->ivals;
+    e->index = NULL;
+    e->index_cap = 0;
+    return e;
+}
+
+/* Give each symbol in a lambda body its address at creation time:
+   formals become a slot in the call frame, globals the slot of their binding */
+void lval_resolve(lenv* e, lval* formals, lval* v) {
+    if (v->type == LVAL_SYM) {
+        int slot = 0;
+        for (int i = 0; i < formals->count; i++) {
+            if (formals->cell[i]->type != LVAL_SYM) { break; }
+            if (formals->cell[i]->sym == sym_amp) { continue; }
+            if (formals->cell[i]->sym == v->sym) {
+                v->depth = 0; v->slot = slot; return;
+            }
+            slot++;
+        }
+        if (!LSYM_LOCAL(v->sym)) { v->slot = lenv_find(lenv_root(e), v->sym); }
+        return;
+    }
+    if ((v->type == LVAL_SEXPR) | (v->type == LVAL_QEXPR)) {
+        for (int i = 0; i < v->count; i++) { lval_resolve(e, formals, v->cell[i]); }
+    }
+}
+
+/* Construct a pointer to a new lambda lval */
+lval* lval_lambda(lenv* e, lval* formals, lval* body) {
+    /* formals are bound per call so they are never global */
+    for (int i = 0; i < formals->count; i++) {
+        if (formals->cell[i]->type == LVAL_SYM) { LSYM_LOCAL(formals->cell[i]->sym) = 1; }
+    }
+    lval_resolve(e, formals, body);
+
+    lval* v = lval_new(LVAL_FUN);
+    v->builtin = NULL;
+    v->env = NULL;
+    v->formals = formals;
+    v->body = body;
+    v->code = NULL;
+
+    /* The arity is fixed now, arguments after '&' are collected in one list */
+    v->arity = formals->count;
+    v->flags = 0;
+    for (int i = 0; i < formals->count; i++) {
+        if (formals->cell[i]->sym == sym_amp) {
+            v->arity = i;
+            v->flags = i == formals->count - 2 ? LFUN_REST : LFUN_BADREST;
+            break;
+        }
+    }
+    return v;
+}
+
+/* delete an environment */
+void lenv_del(lenv* e) {
+    /* Iterate over all items in environment deleting them */
+    for (int i = 0; i < e->count; i++) {
+        lval_del(e->vals[i]);
+    }
+    /* Free allocated memory for lists */
+    if (e->syms != e->isyms) {
+        free(e->syms);
+        free(e->vals);
+    }
+    free(e->index);
+    lpool_free(&lenv_pool, e);
+}
+
+/* hash an interned symbol by its address */
+unsigned long lenv_hash(char* sym) {
+    return ((unsigned long)(uintptr_t)sym >> 3) * 2654435761UL;
+}
+
+/* rebuild the hash index with room for every binding */
+void lenv_reindex(lenv* e) {
+    free(e->index);
+    e->index_cap = e->index_cap ? e->index_cap * 2 : LENV_INLINE * 4;
+    e->index = calloc(e->index_cap, sizeof(int));
+
+    for (int i = 0; i < e->count; i++) {
+        unsigned long j = lenv_hash(e->syms[i]) & (e->index_cap - 1);
+        while (e->index[j]) { j = (j + 1) & (e->index_cap - 1); }
+        e->index[j] = i + 1;
+    }
+}
+
+/* return the slot holding a symbol in this frame only, or -1 */
+int lenv_find(lenv* e, char* sym) {
+    /* small frames are scanned directly */
+    if (!e->index) {
+        for (int i = 0; i < e->count; i++) {
+            if (e->syms[i] == sym) { return i; }
+        }
+        return -1;
+    }
+
+    unsigned long j = lenv_hash(sym) & (e->index_cap - 1);
+    while (e->index[j]) {
+        if (e->syms[e->index[j] - 1] == sym) { return e->index[j] - 1; }
+        j = (j + 1) & (e->index_cap - 1);
+    }
+    return -1;
+}
+
+/* find the outermost environment */
+lenv* lenv_root(lenv* e) {
+    return e->root;
+}
+
+/* make an environment the parent of another */
+void lenv_link(lenv* e, lenv* par) {
+    e->par = par;
+    e->root = par->root;
+}
+
+/* a frame with room for 'n' bindings, such as the arguments of a lambda */
+lenv* lenv_frame(int n) {
+    lenv* e = lenv_new();
+    if (n > LENV_INLINE) {
+        e->cap = n;
+        e->syms = malloc(sizeof(char*) * n);
+        e->vals = malloc(sizeof(lval*) * n);
+    }
+    return e;
+}
+
+/* lookup for a value in the environment */
+lval* lenv_get(lenv* e, lval* k) {
+
+    /* Symbols never bound locally can only live in the global frame */
+    if (!LSYM_LOCAL(k->sym)) {
+        e = lenv_root(e);
+        if (k->slot < 0 || k->slot >= e->count || e->syms[k->slot] != k->sym) {
+            k->slot = lenv_find(e, k->sym);
+        }
+        if (k->slot >= 0) { return lval_copy(e->vals[k->slot]); }
+        return lval_err("Unbound Symbol '%s'", k->sym);
+    }
+
+    /* Search each frame from the innermost outwards */
+    for (int d = 0; e; e = e->par, d++) {
+        /* The cached address is only trusted once the frames above it missed */
+        if (d == k->depth && k->slot < e->count && e->syms[k->slot] == k->sym) {
+            return lval_copy(e->vals[k->slot]);
+        }
+        int i = lenv_find(e, k->sym);
+        /* If it is found, remember where and return a copy of the value */
+        if (i >= 0) {
+            k->depth = d;
+            k->slot = i;
+            return lval_copy(e->vals[i]);
+        }
+    }
+    return lval_err("Unbound Symbol '%s'", k->sym);
+}
+
+/* Insert or replace a binding in this frame, which takes over 'v' */
+void lenv_store(lenv* e, char* sym, lval* v) {
+
+    /* If variable is found delete it and replace it with new var */
+    int i = lenv_find(e, sym);
+    if (i >= 0) {
+        lval_del(e->vals[i]);
+        e->vals[i] = v;
+        return;
+    }
+
+    /* If no existing entry found make space, doubling the arrays */
+    if (e->count == e->cap) {
+        e->cap *= 2;
+        if (e->syms == e->isyms) {
+            e->syms = malloc(sizeof(char*) * e->cap);
+            e->vals = malloc(sizeof(lval*) * e->cap);
+            memcpy(e->syms, e->isyms, sizeof(char*) * e->count);
+            memcpy(e->vals, e->ivals, sizeof(lval*) * e->count);
+        } else {
+            e->syms = realloc(e->syms, sizeof(char*) * e->cap);
+            e->vals = realloc(e->vals, sizeof(lval*) * e->cap);
+        }
+    }
+
+    /* Store the value and the interned symbol */
+    e->vals[e->count] = v;
+    e->syms[e->count] = sym;
+    e->count++;
+
+    /* Index frames that outgrow a linear scan, keeping it half empty */
+    if (e->count > LENV_INLINE) {
+        if (e->count * 2 > e->index_cap) {
+            lenv_reindex(e);
+        } else {
+            unsigned long j = lenv_hash(sym) & (e->index_cap - 1);
+            while (e->index[j]) { j = (j + 1) & (e->index_cap - 1); }
+            e->index[j] = e->count;
+        }
+    }
+}
+
+/* Insert or replace a binding in this frame */
+void lenv_set(lenv* e, char* sym, lval* v) {
+    lenv_store(e, sym, lval_copy(v));
+}
+
+/* Define a value in the global environment */
+void lenv_def(lenv* e, lval* k, lval* v) {
+    lenv_set(lenv_root(e), k->sym, v);
+}
+
+/* Insert a new value in a local environment */
+void lenv_put(lenv* e, lval* k, lval* v) {
+    LSYM_LOCAL(k->sym) = 1;
+    lenv_set(e, k->sym, v);
+}
+
+/* copy an environment */
+lenv* lenv_copy(lenv* e) {
+    lenv* n = lenv_new();
+    n->par = e->par;
+    n->root = e->root == e ? n : e->root;
+
+    /* copy all the variables inside */
+    for (int i = 0; i < e->count; i++) {
+        lenv_set(n, e->syms[i], e->vals[i]);
+    }
+    return n;
+}
+
+
+/* Read and print lvals */
+
+
+/* list of types to use in error reporting */
 char* ltype_name(int t) {
     switch(t) {
         case LVAL_FUN: return "Function";
@@ -481,6 +1699,11 @@ char* ltype_name(int t) {
         case LVAL_SYM: return "Symbol";
         case LVAL_SEXPR: return "S-Expression";
         case LVAL_QEXPR: return "Q-Expression";
+        case LVAL_ARR: return "Array";
+        case LVAL_VEC: return "Vector";
+        case LVAL_MAP: return "Hash Map";
+        case LVAL_SB: return "String Builder";
+        case LVAL_FILE: return "File";
         default: return "Unknown";
     }
 }
@@ -500,19 +1723,32 @@ lval* lval_read_num(mpc_ast_t* t) {
     }
 }
 
+/* characters written with a backslash in strings, and what they stand for */
+char lstr_escapes[]   = "abfnrtv\\'\"0";
+char lstr_unescaped[] = "\a\b\f\n\r\t\v\\\'\"";
+
 /* if lval is of string type it reads it*/
 lval* lval_read_str(mpc_ast_t* t) {
 
-    /* Cut off the final quote character */
-    t->contents[strlen(t->contents)-1] = '\0';
-    /* Copy the string missing out the first quote character */
-    char* unescaped = malloc(strlen(t->contents+1)+1);
-    strcpy(unescaped, t->contents+1);
+    /* Skip the quote characters at both ends */
+    char* s = t->contents + 1;
+    int n = strlen(s) - 1;
+    char* unescaped = malloc(n + 1);
+    int len = 0;
+
+    /* Unescape into the buffer, '\0' becomes an embedded NUL byte */
+    for (int i = 0; i < n; i++) {
+        char* esc = (s[i] == '\\' && i+1 < n) ? strchr(lstr_escapes, s[i+1]) : NULL;
+        if (esc && *esc) {
+            unescaped[len++] = lstr_unescaped[esc - lstr_escapes];
+            i++;
+        } else {
+            unescaped[len++] = s[i];
+        }
+    }
 
-    /* Pass through the unescape function */
-    unescaped = mpcf_unescape(unescaped);
     /* Construct a new lval using the string */
-    lval* str = lval_str(unescaped);
+    lval* str = lval_text(LVAL_STR, unescaped, len);
     /* Free the string and return */
     free(unescaped); return str;
 }
@@ -551,92 +1787,118 @@ lval* lval_eval_sexpr(lenv* e, lval* v);
 void lval_print(lval* v);
 lval* builtin_eval(lenv* e, lval* a);
 lval* builtin_list(lenv* e, lval* a);
+lcode* lcode_lambda(lval* f);
+lval* lvm_exec(lcode* c, lenv* e, lval* fn);
+lval* lvm_eval(lenv* e, lval* x);
+
+
+/* a lambda given fewer arguments than it takes, holding on to them */
+lval* lval_partial(lval* f, lval* a) {
+    if (a->count == 0) { lval_del(a); return lval_copy(f); }
+
+    lval* p = lval_new(LVAL_FUN);
+    p->builtin = NULL;
+    p->formals = lval_copy(f->formals);
+    p->body = lval_copy(f->body);
+    p->code = f->code;
+    if (p->code) { p->code->rc++; }
+    p->arity = f->arity;
+    p->flags = (f->flags & (LFUN_REST | LFUN_BADREST)) | LFUN_PARTIAL;
+
+    /* Arguments from earlier applications come first */
+    a = lval_own(a);
+    a->type = LVAL_QEXPR;
+    if (f->flags & LFUN_PARTIAL) {
+        lval* held = f->args;
+        lval* args = lval_qexpr();
+        args->count = held->count + a->count;
+        args->cell = lcell_alloc(args->count);
+        for (int i = 0; i < held->count; i++) { args->cell[i] = lval_copy(held->cell[i]); }
+        memcpy(args->cell + held->count, a->cell, sizeof(lval*) * a->count);
+        a->count = 0;
+        lval_del(a);
+        a = args;
+    }
+    p->args = a;
+    return p;
+}
 
+/* Apply lambda 'f' to the arguments 'a' without changing it. Returns a copy owning
+   a new frame with the formals bound, an error, or a partial application */
+lval* lval_bind(lval* f, lval* a) {
+    lval* held = f->flags & LFUN_PARTIAL ? f->args : NULL;
+    int nheld = held ? held->count : 0;
+    int given = nheld + a->count;
 
-/* execute costum functions */
-lval* lval_call(lenv* e, lval* f, lval* a) {
-    /* If Builtin then simply apply that */
-    if (f->builtin) { return f->builtin(e, a); }
-
-    /* Record Argument Counts */
-    int given = a->count;
-    int total = f->formals->count;
-
-    while (a->count) {
-        /* If we've ran out of formal arguments to bind */
-        if (f->formals->count == 0) {
-            lval_del(a); return lval_err(
-                "Function passed too many arguments. "
-                "Got %i, Expected %i.", given, total);
-        }
-
-        /* Pop the first symbol and the value next to it */
-        lval* sym = lval_pop(f->formals, 0);
-
-        /* Special Case to deal with '&' */
-        if (strcmp(sym->sym, "&") == 0) {
-
-            /* Ensure '&' is followed by another symbol */
-            if (f->formals->count != 1) {
-                lval_del(a);
-                return lval_err("Function format invalid. "
-                    "Symbol '&' not followed by single symbol.");
-            }
-
-            /* Next formal should be bound to remaining arguments */
-            lval* nsym = lval_pop(f->formals, 0);
-            lenv_put(f->env, nsym, builtin_list(e, a));
-            lval_del(sym); lval_del(nsym);
-            break;
-        }
+    if (given < f->arity) { return lval_partial(f, a); }
 
-        /* Pop the next argument from the list */
-        lval* val = lval_pop(a, 0);
+    if (f->flags & LFUN_BADREST) {
+        lval_del(a);
+        return lval_err("Function format invalid. "
+            "Symbol '&' not followed by single symbol.");
+    }
+    if (!(f->flags & LFUN_REST) && given > f->arity) {
+        lval* err = lval_err("Function passed too many arguments. "
+            "Got %i, Expected %i.", a->count, f->arity - nheld);
+        lval_del(a); return err;
+    }
 
-        /* Bind a copy into of them the function's environment */
-        lenv_put(f->env, sym, val);
+    lval* g = lval_new(LVAL_FUN);
+    g->builtin = NULL;
+    g->formals = lval_copy(f->formals);
+    g->body = lval_copy(f->body);
+    g->code = f->code;
+    if (g->code) { g->code->rc++; }
+    g->arity = f->arity;
+    g->flags = (f->flags & LFUN_REST) | LFUN_BOUND;
+    g->env = lenv_frame(f->arity + (f->flags & LFUN_REST));
+
+    /* The arguments held by a partial application are bound first, then these ones */
+    a = lval_own(a);
+    for (int i = 0; i < f->arity; i++) {
+        lval* val = i < nheld ? lval_copy(held->cell[i]) : a->cell[i - nheld];
+        lenv_store(g->env, f->formals->cell[i]->sym, val);
+    }
 
-        /* Delete symbol and value */
-        lval_del(sym); lval_del(val);
+    /* The rest are moved into a single list for the symbol after '&' */
+    if (f->flags & LFUN_REST) {
+        int n = given - f->arity;
+        lval* rest = lval_qexpr();
+        rest->count = n;
+        rest->cell = lcell_alloc(n);
+        if (n) { memcpy(rest->cell, a->cell + (a->count - n), sizeof(lval*) * n); }
+        lenv_store(g->env, f->formals->cell[f->arity + 1]->sym, rest);
     }
 
+    a->count = 0;
     lval_del(a);
+    return g;
+}
 
-    /* If '&' remains in formal list bind to empty list */
-    if (f->formals->count > 0 &&
-        strcmp(f->formals->cell[0]->sym, "&") == 0) {
-
-        /* Check to ensure that & is not passed invalidly. */
-        if (f->formals->count != 2) {
-            return lval_err("Function format invalid. "
-                "Symbol '&' not followed by single symbol.");
-        }
-
-        /* Pop and delete '&' symbol */
-        lval_del(lval_pop(f->formals, 0));
-
-        /* Pop next symbol and create empty list */
-        lval* sym = lval_pop(f->formals, 0);
-        lval* val = lval_qexpr();
+/* lambdas replaced by a tail call, the frames of their callees still point to them */
+struct {
+    lval** fns;
+    int count;
+    int cap;
+} lkept;
 
-        /* Bind to environment and delete */
-        lenv_put(f->env, sym, val);
-        lval_del(sym); lval_del(val);
+void lkept_push(lval* fn) {
+    if (lkept.count == lkept.cap) {
+        lkept.cap = lkept.cap ? lkept.cap * 2 : 64;
+        lkept.fns = realloc(lkept.fns, sizeof(lval*) * lkept.cap);
     }
+    lkept.fns[lkept.count++] = fn;
+}
 
-    /* If all formals have been bound evaluate */
-    if (f->formals->count == 0) {
-
-        /* Set environment parent to evaluation environment */
-        f->env->par = e;
+/* release the lambdas kept since 'base' */
+void lkept_release(int base) {
+    while (lkept.count > base) { lval_del(lkept.fns[--lkept.count]); }
+}
 
-        /* Evaluate and return */
-        return builtin_eval(
-            f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
-    } else {
-        /* Otherwise return partially evaluated function */
-        return lval_copy(f);
-    }
+/* a self tail call binds its arguments into the running frame instead of a new one,
+   the old bindings are all shadowed or would still be visible through the parent */
+void lenv_rebind(lenv* e, lenv* args) {
+    for (int i = 0; i < args->count; i++) { lenv_set(e, args->syms[i], args->vals[i]); }
 }
 
 /* identifies S-expressions and call functions to evaluate them */
@@ -649,32 +1911,245 @@ lval* lval_eval(lenv* e, lval* v) {
     return v;
 }
 
-lval* builtin_exit(lenv* e, lval* a);
-lval* builtin_env(lenv* e, lval* a);
-/* Evaluate S-expressions */
-lval* lval_eval_sexpr(lenv* e, lval* v) {
+/* special forms, recognised by the builtin their head is bound to */
+enum { LFORM_NONE, LFORM_IF, LFORM_AND, LFORM_OR, LFORM_AND2, LFORM_OR2, LFORM_LET, LFORM_DO,
+    LFORM_SELECT };
 
-    /* Evaluate Children */
-    for (int i = 0; i < v->count; i++) {
-        v->cell[i] = lval_eval(e, v->cell[i]);
-    }
+/* a S-expression being evaluated, the children before 'i' hold their values
+   and those from 'end' on are only evaluated when a special form needs them */
+typedef struct lstep {
+    lenv* env;
+    lval* v;
+    int i;
+    int end;
+    int form;
+    /* the lambda whose frame is env, if one was entered by a tail call here */
+    lval* fn;
+    int kept;
+} lstep;
+
+/* Nested expressions are evaluated on this stack rather than the C stack, its
+   depth counts vm frames too and is limited so runaway recursion is an error */
+struct {
+    lstep* steps;
+    int count;
+    int cap;
+    int depth;
+    int limit;
+    /* where main keeps its locals, the C stack grows away from here */
+    char* cbase;
+} lstack = { NULL, 0, 0, 0, 100000, NULL };
+
+/* Builtins that call back into lisp code nest on the C stack, which is much
+   smaller than lstack, so the bytes those calls may use are limited too */
+#ifdef _WIN32
+#define LSTACK_NATIVE (512 * 1024)
+#else
+#define LSTACK_NATIVE (4 * 1024 * 1024)
+#endif
 
-    /* Error Checking */
-    for (int i = 0; i < v->count; i++) {
-        if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
-    }
+/* true when entering the evaluator again would go too deep */
+int lstack_full(void) {
+    char here;
+    uintptr_t a = (uintptr_t)lstack.cbase;
+    uintptr_t b = (uintptr_t)&here;
+    return lstack.depth >= lstack.limit || (a > b ? a - b : b - a) > LSTACK_NATIVE;
+}
 
-    /* Empty Expression */
-    if (v->count == 0) { return v; }
+lval* lstack_overflow(void) {
+    if (lstack.depth < lstack.limit) {
+        return lval_err("Builtins called back into functions too deeply");
+    }
+    return lval_err("Maximum evaluation depth of %i exceeded", lstack.limit);
+}
 
-    /* special case for exit and env functions */
-    if ((v->cell[0]->builtin == builtin_exit) | (v->cell[0]->builtin == builtin_env)) {
-        lval* f = lval_pop(v, 0);
-        lval* result = f->builtin(e, v);
-        lval_del(f); return result;
+void lstack_push(lenv* e, lval* v, int i) {
+    if (lstack.count == lstack.cap) {
+        lstack.cap = lstack.cap ? lstack.cap * 2 : 64;
+        lstack.steps = realloc(lstack.steps, sizeof(lstep) * lstack.cap);
     }
+    lstep* s = &lstack.steps[lstack.count++];
+    s->env = e;
+    s->v = v;
+    s->i = i;
+    s->end = v->count;
+    s->form = LFORM_NONE;
+    s->fn = NULL;
+    s->kept = lkept.count;
+    lstack.depth++;
+}
 
-    /* Single Expression */
+lval* builtin_exit(lenv* e, lval* a);
+lval* builtin_env(lenv* e, lval* a);
+lval* builtin_gc(lenv* e, lval* a);
+lval* builtin_mem(lenv* e, lval* a);
+lval* builtin_if(lenv* e, lval* a);
+lval* builtin_if_branch(lval* a);
+lval* builtin_select(lenv* e, lval* a);
+lval* builtin_select_branch(lval* a);
+lval* builtin_eval_expr(lval* a);
+lval* builtin_pack(lenv* e, lval* a);
+lval* builtin_unpack(lenv* e, lval* a);
+lval* builtin_pack_expr(lval* a);
+lval* builtin_unpack_expr(lval* a);
+lval* builtin_and(lenv* e, lval* a);
+lval* builtin_or(lenv* e, lval* a);
+lval* builtin_let(lenv* e, lval* a);
+lval* builtin_do(lenv* e, lval* a);
+lval* builtin_let_body(lval* a);
+
+/* continue a step with another expression, in tail position */
+lval* lstep_next(lstep* s, lval* x) {
+    if (x->type == LVAL_ERR) { return x; }
+    s->v = lval_own(x);
+    s->v->type = LVAL_SEXPR;
+    s->i = 0;
+    s->end = s->v->count;
+    s->form = LFORM_NONE;
+    return NULL;
+}
+
+/* make the frame of a bound lambda the one the step evaluates in. A self tail
+   call binds into the running frame, others keep their caller */
+void lstep_enter(lstep* s, lval* g) {
+    if (s->fn && g->body == s->fn->body) {
+        lenv_rebind(s->env, g->env);
+        lval_del(g);
+        return;
+    }
+    lenv_link(g->env, s->env);
+    if (s->fn) { lkept_push(s->fn); }
+    s->fn = g;
+    s->env = g->env;
+}
+
+/* a lambda without formals owning the scope opened by 'let' */
+lval* lval_scope(lval* body) {
+    lval* g = lval_new(LVAL_FUN);
+    g->builtin = NULL;
+    g->env = lenv_new();
+    g->formals = lval_qexpr();
+    g->body = lval_copy(body);
+    g->code = NULL;
+    g->arity = 0;
+    g->flags = LFUN_BOUND;
+    return g;
+}
+
+/* once the head of a step is known, see if it starts a special form */
+void lstep_form(lstep* s) {
+    lval* v = s->v;
+    lval* f = v->cell[0];
+    if (f->type != LVAL_FUN || !f->builtin) { return; }
+
+    if (f->builtin == builtin_if && v->count == 4 &&
+        v->cell[2]->type == LVAL_QEXPR && v->cell[3]->type == LVAL_QEXPR) {
+        s->form = LFORM_IF; s->end = 2;
+    }
+    if ((f->builtin == builtin_and) | (f->builtin == builtin_or) && v->count == 3) {
+        s->form = f->builtin == builtin_and ? LFORM_AND : LFORM_OR; s->end = 2;
+    }
+    if (f->builtin == builtin_let && v->count == 2 && v->cell[1]->type == LVAL_QEXPR) {
+        s->form = LFORM_LET; s->end = 1;
+    }
+    if (f->builtin == builtin_do && v->count > 1) {
+        s->form = LFORM_DO; s->end = v->count - 1;
+    }
+}
+
+/* the truth value of an operand of 'if', 'and' or 'or', NULL when it is an integer */
+lval* lform_check(char* func, lval* x, int index) {
+    if (x->type == LVAL_ERR) { return lval_copy(x); }
+    if (x->type != LVAL_LONG) {
+        return lval_err("Function '%s' passed incorrect type for argument %i. "
+            "Got %s, Expected %s.", func, index, ltype_name(x->type), ltype_name(LVAL_LONG));
+    }
+    return NULL;
+}
+
+/* carry on with a special form once the children it needs are evaluated */
+lval* lstep_special(lstep* s) {
+    lval* v = s->v;
+    lval* x;
+
+    switch (s->form) {
+        /* only the branch chosen is run */
+        case LFORM_IF:
+            if ((x = lform_check("if", v->cell[1], 0))) { lval_del(v); return x; }
+            x = lval_copy(v->cell[v->cell[1]->num ? 2 : 3]);
+            lval_del(v);
+            return lstep_next(s, x);
+
+        /* the second operand is only evaluated when the first does not decide */
+        case LFORM_AND:
+        case LFORM_OR: {
+            int is_and = s->form == LFORM_AND;
+            if ((x = lform_check(is_and ? "and" : "or", v->cell[1], 0))) { lval_del(v); return x; }
+            if (is_and ? v->cell[1]->num == 0 : v->cell[1]->num != 0) {
+                lval_del(v); return lval_long(!is_and);
+            }
+            s->form = is_and ? LFORM_AND2 : LFORM_OR2;
+            s->end = 3;
+            return NULL;
+        }
+        case LFORM_AND2:
+        case LFORM_OR2:
+            if ((x = lform_check(s->form == LFORM_AND2 ? "and" : "or", v->cell[2], 1))) {
+                lval_del(v); return x;
+            }
+            x = lval_long(v->cell[2]->num != 0);
+            lval_del(v); return x;
+
+        /* a new scope below the current one, entered like a lambda */
+        case LFORM_LET:
+            x = lval_copy(v->cell[1]);
+            lval_del(v);
+            lstep_enter(s, lval_scope(x));
+            return lstep_next(s, x);
+
+        /* everything but the last expression is evaluated here, the last in tail position */
+        case LFORM_DO:
+            for (int i = 1; i < s->end; i++) {
+                if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+            }
+            x = lval_take(v, v->count - 1);
+            if (x->type == LVAL_SEXPR) { return lstep_next(s, x); }
+            if (x->type == LVAL_SYM) {
+                lval* y = lenv_get(s->env, x);
+                lval_del(x); return y;
+            }
+            return x;
+    }
+    return NULL;
+}
+
+/* apply a S-expression whose children are evaluated. Returns the result, or NULL
+   when the step was given the next expression to evaluate instead: lambda bodies
+   and what 'if', 'eval', 'pack' and 'unpack' run are in tail position, so
+   iteration written as recursion does not make the stack grow. Builtins may run
+   the evaluator again, which can move the steps: 's' is stale once they return */
+lval* lstep_apply(lstep* s) {
+    if (s->form) { return lstep_special(s); }
+    lval* v = s->v;
+
+    /* Error Checking */
+    for (int i = 0; i < v->count; i++) {
+        if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+    }
+
+    /* Empty Expression */
+    if (v->count == 0) { return v; }
+
+    /* special case for exit, env, gc and mem functions */
+    if (v->cell[0]->type == LVAL_FUN &&
+        ((v->cell[0]->builtin == builtin_exit) | (v->cell[0]->builtin == builtin_env) |
+        (v->cell[0]->builtin == builtin_gc) | (v->cell[0]->builtin == builtin_mem))) {
+        lval* f = lval_pop(v, 0);
+        lval* result = f->builtin(s->env, v);
+        lval_del(f); return result;
+    }
+
+    /* Single Expression */
     if (v->count == 1) { return lval_take(v, 0); }
 
     /* Ensure first element is a function after evaluation */
@@ -688,14 +2163,149 @@ lval* lval_eval_sexpr(lenv* e, lval* v) {
         return err;
     }
 
-    /* If so call function to get result */
-    lval* result = lval_call(e, f, v);
+    lval* x;
+    if (f->builtin == builtin_if) {
+        x = builtin_if_branch(v);
+    } else if (f->builtin == builtin_select) {
+        x = builtin_select_branch(v);
+    } else if (f->builtin == builtin_eval) {
+        x = builtin_eval_expr(v);
+    } else if (f->builtin == builtin_pack) {
+        x = builtin_pack_expr(v);
+    } else if (f->builtin == builtin_unpack) {
+        x = builtin_unpack_expr(v);
+    } else if (f->builtin == builtin_let) {
+        x = builtin_let_body(v);
+        if (x->type != LVAL_ERR) { lstep_enter(s, lval_scope(x)); }
+    } else if (f->builtin) {
+        lval* result = f->builtin(s->env, v);
+        lval_del(f); return result;
+    } else {
+        /* under the vm the body is compiled the first time it runs */
+        if (lvm_enabled && !f->code) { f->code = lcode_lambda(f); }
+
+        /* Return errors and partially evaluated functions */
+        lval* g = lval_bind(f, v);
+        lval_del(f);
+        if (g->type == LVAL_ERR || !(g->flags & LFUN_BOUND)) { return g; }
+
+        /* the vm frame takes over the bound copy */
+        if (g->code) {
+            lenv_link(g->env, s->env);
+            return lvm_exec(g->code, g->env, g);
+        }
+
+        /* The body is evaluated as a S-expression */
+        x = lval_copy(g->body);
+        lstep_enter(s, g);
+        return lstep_next(s, x);
+    }
     lval_del(f);
-    return result;
+
+    return lstep_next(s, x);
 }
 
-/* equality comparison */
-int lval_eq(lval* x, lval* y) {
+/* evaluate a S-expression whose children before 'i' are already values */
+lval* lval_run(lenv* e, lval* v, int i) {
+    if (lstack_full()) {
+        lval_del(v); return lstack_overflow();
+    }
+
+    int base = lstack.count;
+    lstack_push(e, v, i);
+
+    for (;;) {
+        /* pushing may move the steps, so this is fetched again every time */
+        lstep* s = &lstack.steps[lstack.count - 1];
+
+        /* Evaluate Children, nested expressions get a step of their own */
+        if (s->i < s->end) {
+            lval* c = s->v->cell[s->i];
+            if (c->type == LVAL_SEXPR) {
+                if (lstack.depth >= lstack.limit) {
+                    s->v->cell[s->i++] = lstack_overflow();
+                    lval_del(c);
+                } else {
+                    lstack_push(s->env, lval_own(c), 0);
+                }
+                continue;
+            }
+            if (c->type == LVAL_SYM) {
+                s->v->cell[s->i] = lenv_get(s->env, c);
+                lval_del(c);
+                if (s->i == 0) { lstep_form(s); }
+            }
+            s->i++;
+            continue;
+        }
+
+        lval* r = lstep_apply(s);
+        if (!r) { continue; }
+
+        /* The step is done, its value goes to the expression that contained it.
+           Builtins that evaluate may have moved the steps */
+        s = &lstack.steps[lstack.count - 1];
+        lkept_release(s->kept);
+        if (s->fn) { lval_del(s->fn); }
+        lstack.count--;
+        lstack.depth--;
+        if (lstack.count == base) { return r; }
+
+        s = &lstack.steps[lstack.count - 1];
+        s->v->cell[s->i++] = r;
+    }
+}
+
+/* apply an S-expression whose children are already evaluated */
+lval* lval_apply(lenv* e, lval* v) {
+    return lval_run(e, v, v->count);
+}
+
+/* Evaluate S-expressions */
+lval* lval_eval_sexpr(lenv* e, lval* v) {
+    /* Children are replaced by their values so work on a private copy */
+    return lval_run(e, lval_own(v), 0);
+}
+
+/* numeric value of an integer or decimal as a double */
+double lval_to_double(lval* v) {
+    return v->type == LVAL_LONG ? (double)v->num : v->dec;
+}
+
+/* pairs of values lval_eq still has to compare, nested values are pushed here
+   instead of recursing so deep lists can't overflow the C stack */
+struct {
+    lval** pairs;
+    int count;
+    int cap;
+} leq;
+
+void leq_push(lval* x, lval* y) {
+    if (leq.count == leq.cap) {
+        leq.cap = leq.cap ? leq.cap * 2 : 64;
+        leq.pairs = realloc(leq.pairs, sizeof(lval*) * leq.cap);
+    }
+    leq.pairs[leq.count++] = x;
+    leq.pairs[leq.count++] = y;
+}
+
+/* compare the top level of two values, pushing the pairs of elements they hold */
+int lval_eq_step(lval* x, lval* y) {
+    /* text equals itself without reading it, containers are walked since they may hold a NaN */
+    if (x == y && ((x->type == LVAL_STR) | (x->type == LVAL_SB) | (x->type == LVAL_ERR))) {
+        return 1;
+    }
+
+    /* Vectors equal lists or vectors with the same elements */
+    if (((x->type == LVAL_VEC) | (y->type == LVAL_VEC)) &&
+        ((x->type == LVAL_VEC) | (x->type == LVAL_QEXPR)) &&
+        ((y->type == LVAL_VEC) | (y->type == LVAL_QEXPR))) {
+        if (lval_seq_count(x) != lval_seq_count(y)) { return 0; }
+        for (int i = lval_seq_count(x) - 1; i >= 0; i--) {
+            leq_push(lval_seq_get(x, i), lval_seq_get(y, i));
+        }
+        return 1;
+    }
 
     /* Different Types are always unequal, except integers and decimals */
     if (!(((x->type == LVAL_LONG) & (y->type == LVAL_DOUBLE)) |
@@ -707,38 +2317,91 @@ int lval_eq(lval* x, lval* y) {
     switch (x->type) {
         /* Compare Number Value */
         case LVAL_LONG:
+            if (y->type == LVAL_LONG) { return (x->num == y->num); }
+            return (lval_to_double(x) == lval_to_double(y));
         case LVAL_DOUBLE:
-            return (x->dec == y->dec);
+            return (lval_to_double(x) == lval_to_double(y));
 
-        /* Compare String Values */
-        case LVAL_ERR: return (strcmp(x->err, y->err) == 0);
-        case LVAL_SYM: return (strcmp(x->sym, y->sym) == 0);
-        case LVAL_STR: return (strcmp(x->str, y->str) == 0);
+        /* Compare String Values, symbols are interned */
+        case LVAL_SYM: return (x->sym == y->sym);
+        case LVAL_ERR:
+        case LVAL_STR:
+            return (x->len == y->len) && (memcmp(x->str, y->str, x->len) == 0);
 
         /* If builtin compare, otherwise compare formals and body */
         case LVAL_FUN:
             if (x->builtin || y->builtin) {
                 return (x->builtin == y->builtin);
             } else {
-                return (lval_eq(x->formals, y->formals)
-                && lval_eq(x->body, y->body));
+                if ((x->flags ^ y->flags) & LFUN_PARTIAL) { return 0; }
+                if (x->flags & LFUN_PARTIAL) { leq_push(x->args, y->args); }
+                leq_push(x->body, y->body);
+                leq_push(x->formals, y->formals);
+                return 1;
+            }
+
+        /* Arrays compare their elements as numbers */
+        case LVAL_ARR:
+            if (x->size != y->size) { return 0; }
+            for (int i = 0; i < x->size; i++) {
+                if ((x->elem == LARR_I64) & (y->elem == LARR_I64)) {
+                    if (x->i64[i] != y->i64[i]) { return 0; }
+                } else if (larr_double(x, i) != larr_double(y, i)) { return 0; }
+            }
+            return 1;
+
+        /* Handles are equal when they refer to the same file */
+        case LVAL_FILE: return x->file == y->file;
+
+        /* Builders compare their text */
+        case LVAL_SB: {
+            if (x->slen != y->slen) { return 0; }
+            lval* s = lval_sb_str(x);
+            lval* t = lval_sb_str(y);
+            int eq = memcmp(s->str, t->str, s->len) == 0;
+            lval_del(s); lval_del(t);
+            return eq;
+        }
+
+        /* Hash maps need the same keys bound to equal values */
+        case LVAL_MAP:
+            if (x->mcount != y->mcount) { return 0; }
+            for (int i = 0; i < x->mcap; i++) {
+                lslot* s = &x->slots[i];
+                if (!s->key) { continue; }
+                lslot* t = &y->slots[lmap_find(y, s->key, s->hash)];
+                if (!t->key) { return 0; }
+                leq_push(s->val, t->val);
             }
+            return 1;
 
         /* If list compare every individual element */
         case LVAL_QEXPR:
         case LVAL_SEXPR:
             if (x->count != y->count) { return 0; }
-            for (int i = 0; i < x->count; i++) {
-                /* If any element not equal then whole list not equal */
-                if (!lval_eq(x->cell[i], y->cell[i])) { return 0; }
+            /* pushed backwards so the first elements are compared first */
+            for (int i = x->count - 1; i >= 0; i--) {
+                leq_push(x->cell[i], y->cell[i]);
             }
-            /* Otherwise lists must be equal */
             return 1;
         break;
     }
     return 0;
 }
 
+/* equality comparison */
+int lval_eq(lval* x, lval* y) {
+    /* looking up map keys compares them too, so work above the pairs already queued */
+    int base = leq.count;
+    int eq = lval_eq_step(x, y);
+    while (eq && leq.count > base) {
+        leq.count -= 2;
+        eq = lval_eq_step(leq.pairs[leq.count], leq.pairs[leq.count + 1]);
+    }
+    leq.count = base;
+    return eq;
+}
+
 /* Print every element of an expression */
 void lval_print_expr(lval* v, char open, char close) {
     putchar(open);
@@ -757,39 +2420,101 @@ void lval_print_expr(lval* v, char open, char close) {
 
 /* print strings */
 void lval_print_str(lval* v) {
-    /* Make a Copy of the string */
-    char* escaped = malloc(strlen(v->str)+1);
-    strcpy(escaped, v->str);
-    /* Pass it through the escape function */
-    escaped = mpcf_escape(escaped);
-    /* Print it between " characters */
-    printf("\"%s\"", escaped);
-    /* free the copied string */
-    free(escaped);
+    /* Print it between " characters, escaping every special byte */
+    putchar('"');
+    for (int i = 0; i < v->len; i++) {
+        char* esc = memchr(lstr_unescaped, v->str[i], sizeof(lstr_unescaped));
+        if (esc) {
+            putchar('\\');
+            putchar(lstr_escapes[esc - lstr_unescaped]);
+        } else {
+            putchar(v->str[i]);
+        }
+    }
+    putchar('"');
+}
+
+/* print arrays as the conversion that would make them */
+void lval_print_array(lval* v) {
+    fputs(v->elem == LARR_I64 ? "i64{" : "f64{", stdout);
+    for (int i = 0; i < v->size; i++) {
+        if (i) { putchar(' '); }
+        if (v->elem == LARR_I64) {
+            printf("%lli", (long long)v->i64[i]);
+        } else {
+            printf("%f", v->f64[i]);
+        }
+    }
+    putchar('}');
+}
+
+/* print vectors as the conversion that would make them */
+void lval_print_vec(lval* v) {
+    fputs("vec{", stdout);
+    for (int i = 0; i < v->vcount; i++) {
+        if (i) { putchar(' '); }
+        lval_print(lval_vec_get(v, i));
+    }
+    putchar('}');
+}
+
+/* print hash maps as the pairs that would make them */
+void lval_print_map(lval* v) {
+    fputs("hash{", stdout);
+    for (int i = 0, n = 0; i < v->mcap; i++) {
+        if (!v->slots[i].key) { continue; }
+        if (n++) { putchar(' '); }
+        putchar('{');
+        lval_print(v->slots[i].key);
+        putchar(' ');
+        lval_print(v->slots[i].val);
+        putchar('}');
+    }
+    putchar('}');
 }
 
 /* Identify and format the different types for print */
 void lval_print(lval* v) {
     switch (v->type) {
-        case LVAL_LONG:
-            if (abs(v->num - v->dec) > 0.000001) {
-                printf("%f", v->dec); break;
-            }
-            printf("%li", v->num); break;
+        case LVAL_LONG:   printf("%li", v->num); break;
         case LVAL_DOUBLE: printf("%f", v->dec); break;
-        case LVAL_ERR:    printf("Error: %s", v->err); break;
+        case LVAL_ERR:
+            fputs("Error: ", stdout);
+            fwrite(v->str, 1, v->len, stdout);
+        break;
         case LVAL_SYM:    printf("%s", v->sym); break;
         case LVAL_STR:    lval_print_str(v); break;
         case LVAL_FUN:
             if (v->builtin) {
                 printf("<builtin>");
             } else {
-                printf("(\\ "); lval_print(v->formals);
+                /* a partial application shows the formals still to be given */
+                lval rest;
+                rest.type = LVAL_QEXPR;
+                rest.count = v->formals->count;
+                rest.cell = v->formals->cell;
+                if (v->flags & LFUN_PARTIAL) {
+                    rest.count -= v->args->count;
+                    rest.cell += v->args->count;
+                }
+                printf("(\\ "); lval_print(&rest);
                 putchar(' '); lval_print(v->body); putchar(')');
             }
         break;
         case LVAL_SEXPR:  lval_print_expr(v, '(', ')'); break;
         case LVAL_QEXPR:  lval_print_expr(v, '{', '}'); break;
+        case LVAL_ARR:    lval_print_array(v); break;
+        case LVAL_VEC:    lval_print_vec(v); break;
+        case LVAL_MAP:    lval_print_map(v); break;
+        case LVAL_FILE:
+            printf("<file \"%s\">", v->file->name);
+        break;
+        case LVAL_SB: {
+            lval* t = lval_sb_str(v);
+            fputs("sb{", stdout); lval_print_str(t); putchar('}');
+            lval_del(t);
+        }
+        break;
     }
 }
 
@@ -800,10 +2525,20 @@ void lval_println(lval* v) { lval_print(v); putchar('\n'); }
 /* Builtin functions */
 
 
+/* the text of views doesn't end in a NUL, make argument 'i' a copy that does
+   before it is handed to the C library */
+lval* lval_arg_cstr(lval* a, int i) {
+    if (a->cell[i]->kind == LSTR_OWN) { return a; }
+    a = lval_own(a);
+    a->cell[i] = lval_materialize(a->cell[i]);
+    return a;
+}
+
 /* read external files */
 lval* builtin_load(lenv* e, lval* a) {
     LASSERT_NUM("load", a, 1);
     LASSERT_TYPE("load", a, 0, LVAL_STR);
+    a = lval_arg_cstr(a, 0);
 
     /* Parse File given by string name */
     mpc_result_t r;
@@ -815,7 +2550,8 @@ lval* builtin_load(lenv* e, lval* a) {
 
         /* Evaluate each Expression */
         while (expr->count) {
-             lval* x = lval_eval(e, lval_pop(expr, 0));
+            lval* y = lval_pop(expr, 0);
+            lval* x = lvm_enabled ? lvm_eval(e, y) : lval_eval(e, y);
             /* If Evaluation leads to error print it */
             if (x->type == LVAL_ERR) { lval_println(x); }
             lval_del(x);
@@ -843,6 +2579,39 @@ lval* builtin_load(lenv* e, lval* a) {
     }
 }
 
+/* run what is read from a pipe one expression at a time, so no more of it is
+   kept than the longest expression. Those before a syntax error are evaluated */
+lval* lval_load_pipe(lenv* e, char* name, FILE* pipe) {
+    mpc_input_t* in = mpc_input_new_pipe(name, pipe);
+    mpc_result_t r;
+    int ok;
+    while ((ok = mpc_parse_input(in, Form, &r))) {
+
+        /* Only blanks were left once the form ends in <end> */
+        mpc_ast_t* t = r.output;
+        int end = strstr(t->children[t->children_num-1]->tag, "end") != NULL;
+        lval* expr = end ? lval_sexpr() : lval_read(t);
+        mpc_ast_delete(t);
+
+        while (expr->count) {
+            lval* y = lval_pop(expr, 0);
+            lval* x = lvm_enabled ? lvm_eval(e, y) : lval_eval(e, y);
+            if (x->type == LVAL_ERR) { lval_println(x); }
+            lval_del(x);
+        }
+        lval_del(expr);
+        if (end) { break; }
+    }
+    mpc_input_delete(in);
+    if (ok) { return lval_sexpr(); }
+
+    char* err_msg = mpc_err_string(r.error);
+    mpc_err_delete(r.error);
+    lval* err = lval_err("Could not load Library %s", err_msg);
+    free(err_msg);
+    return err;
+}
+
 /* print message from user input */
 lval* builtin_print(lenv* e, lval* a) {
 
@@ -864,33 +2633,103 @@ lval* builtin_error(lenv* e, lval* a) {
     LASSERT_TYPE("error", a, 0, LVAL_STR);
 
     /* Construct Error from first argument */
-    lval* err = lval_err(a->cell[0]->str);
+    lval* err = lval_text(LVAL_ERR, a->cell[0]->str, a->cell[0]->len);
 
     /* Delete arguments and return */
     lval_del(a);
     return err;
 }
 
+/* map a file into memory as a string */
+lval* builtin_mmap(lenv* e, lval* a) {
+    LASSERT_NUM("mmap", a, 1);
+    LASSERT_TYPE("mmap", a, 0, LVAL_STR);
+    a = lval_arg_cstr(a, 0);
+
+    lval* x = lval_mapped(a->cell[0]->str);
+    LASSERT(a, x, "Could not map file %s: %s", a->cell[0]->str, strerror(errno));
+    lval_del(a); return x;
+}
+
+/* the characters of a string from one index up to another */
+lval* builtin_substring(lenv* e, lval* a) {
+    LASSERT_NUM("substring", a, 3);
+    LASSERT_TYPE("substring", a, 0, LVAL_LONG);
+    LASSERT_TYPE("substring", a, 1, LVAL_LONG);
+    LASSERT_TYPE("substring", a, 2, LVAL_STR);
+
+    long i = a->cell[0]->num;
+    long j = a->cell[1]->num;
+    int len = a->cell[2]->len;
+    LASSERT(a, (i >= 0) & (i <= j) & (j <= len),
+        "Function 'substring' cannot take %li to %li from a string of length %i", i, j, len);
+    return lval_substr(lval_take(a, 2), i, j);
+}
+
+/* the pieces of 's' between each 'sep', the last one is left out if it is empty
+   and 'last' isn't set. Long pieces are views of 's' */
+lval* lval_split_text(lval* s, char* sep, int seplen, int last) {
+    lval* x = lval_qexpr();
+    int from = 0;
+    for (int i = 0; i + seplen <= s->len; ) {
+        char* at = memchr(s->str + i, sep[0], s->len - seplen + 1 - i);
+        if (!at) { break; }
+        i = at - s->str;
+        if (memcmp(at, sep, seplen)) { i++; continue; }
+        x = lval_add(x, lval_substr(lval_copy(s), from, i));
+        i += seplen;
+        from = i;
+    }
+    if (last || from < s->len) { x = lval_add(x, lval_substr(lval_copy(s), from, s->len)); }
+    lval_del(s);
+    return x;
+}
+
+/* split a string on every occurrence of a separator */
+lval* builtin_split_on(lenv* e, lval* a) {
+    LASSERT_NUM("split-on", a, 2);
+    LASSERT_TYPE("split-on", a, 0, LVAL_STR);
+    LASSERT_TYPE("split-on", a, 1, LVAL_STR);
+    LASSERT(a, a->cell[0]->len > 0, "Function 'split-on' passed an empty separator");
+
+    lval* x = lval_split_text(lval_copy(a->cell[1]), a->cell[0]->str, a->cell[0]->len, 1);
+    lval_del(a); return x;
+}
+
+/* the lines of a string without their newlines, like 'read-line' gives them */
+lval* builtin_lines(lenv* e, lval* a) {
+    LASSERT_NUM("lines", a, 1);
+    LASSERT_TYPE("lines", a, 0, LVAL_STR);
+    return lval_split_text(lval_take(a, 0), "\n", 1, 0);
+}
+
+/* a copy of the text of a view, which no longer keeps the string it came from */
+lval* builtin_materialize(lenv* e, lval* a) {
+    LASSERT_NUM("materialize", a, 1);
+    LASSERT_TYPE("materialize", a, 0, LVAL_STR);
+    return lval_materialize(lval_take(a, 0));
+}
+
 /* return first element of a qexpr and deletes the rest */
 lval* builtin_head(lenv* e, lval* a) {
     LASSERT_NUM("head", a, 1);
     LASSERT_NOT_EMPTY("head", a, 0);
 
+    /* lists and vectors give a view of their first element */
     if (a->cell[0]->type == LVAL_QEXPR) {
-        lval* v = lval_take(a, 0);
-        while (v->count > 1) { lval_del(lval_pop(v, 1)); }
-        return v;
+        return lval_slice(lval_take(a, 0), 0, 1);
+    }
+    else if (a->cell[0]->type == LVAL_VEC) {
+        return lval_vec_slice(lval_take(a, 0), 0, 1);
     }
     /* return only first character for strings */
     else if (a->cell[0]->type == LVAL_STR) {
-        char num = (a->cell[0]->str)[0];
-        char letter[12];
-        letter[0] = (char)num;
-        lval_del(a); return lval_str(letter);
+        lval* x = lval_text(LVAL_STR, a->cell[0]->str, 1);
+        lval_del(a); return x;
     }
 
     lval_del(a);
-    return lval_err("Function 'head' expected a String or a Q-expression");
+    return lval_err("Function 'head' expected a String, a Q-expression or a Vector");
 }
 
 /* remove first element of a qexpr and return the rest */
@@ -900,47 +2739,61 @@ lval* builtin_tail(lenv* e, lval* a) {
 
     if (a->cell[0]->type == LVAL_QEXPR) {
         lval* v = lval_take(a, 0);
-        lval_del(lval_pop(v, 0));
-        return v;
+        return lval_slice(v, 1, v->count);
+    }
+    else if (a->cell[0]->type == LVAL_VEC) {
+        lval* v = lval_take(a, 0);
+        return lval_vec_slice(v, 1, v->vcount);
     }
     /* remove only first character for strings */
     else if (a->cell[0]->type == LVAL_STR) {
-        char* s = (a->cell[0]->str);
-        char text[strlen(s)];
-        int i;
-
-        for (i = 0; s[i+1] != '\0'; ++i) { text[i] = s[i+1]; }
-        text[i] = '\0';
-
-        lval_del(a); return lval_str(text);
+        lval* s = lval_take(a, 0);
+        return lval_substr(s, 1, s->len);
     }
 
     lval_del(a);
-    return lval_err("Function 'tail' expected a String or a Q-expression");
+    return lval_err("Function 'tail' expected a String, a Q-expression or a Vector");
 }
 
 /* convert sexpr into qexpr */
 lval* builtin_list(lenv* e, lval* a) {
+    a = lval_own(a);
     a->type = LVAL_QEXPR;
     return a;
 }
 
-/* convert qexpr into sexpr and evaluates it */
-lval* builtin_eval(lenv* e, lval* a) {
+/* check the argument of 'eval' and return it as a sexpr */
+lval* builtin_eval_expr(lval* a) {
     LASSERT_NUM("eval", a, 1);
-    LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
+    LASSERT(a, (a->cell[0]->type == LVAL_QEXPR) | (a->cell[0]->type == LVAL_VEC),
+        "Function 'eval' expected a Q-expression or a Vector");
 
     lval* x = lval_take(a, 0);
+    if (x->type == LVAL_VEC) {
+        lval* l = lval_vec_to_list(x);
+        lval_del(x); x = l;
+    }
+    x = lval_own(x);
     x->type = LVAL_SEXPR;
-    return lval_eval(e, x);
+    return x;
+}
+
+/* convert qexpr into sexpr and evaluates it */
+lval* builtin_eval(lenv* e, lval* a) {
+    lval* x = builtin_eval_expr(a);
+    return x->type == LVAL_ERR ? x : lval_eval(e, x);
 }
 
 /* join multiple qexprs or strings */
 lval* builtin_join(lenv* e, lval* a) {
 
-    if (a->cell[0]->type == LVAL_QEXPR) {
+    /* lists and vectors can be joined together, the result is of the first kind */
+    if ((a->cell[0]->type == LVAL_QEXPR) | (a->cell[0]->type == LVAL_VEC)) {
         for (int i = 0; i < a->count; i++) {
-            LASSERT_TYPE("join", a, i, LVAL_QEXPR);
+            LASSERT(a, (a->cell[i]->type == LVAL_QEXPR) | (a->cell[i]->type == LVAL_VEC),
+                "Function 'join' passed incorrect type for argument %i. "
+                "Got %s, Expected %s or %s.", i, ltype_name(a->cell[i]->type),
+                ltype_name(LVAL_QEXPR), ltype_name(LVAL_VEC));
         }
     } else {
         for (int i = 0; i < a->count; i++) {
@@ -948,6 +2801,20 @@ lval* builtin_join(lenv* e, lval* a) {
         }
     }
 
+    /* Strings are joined with a single allocation */
+    if (a->cell[0]->type == LVAL_STR) {
+        int len = 0;
+        for (int i = 0; i < a->count; i++) { len += a->cell[i]->len; }
+
+        lval* x = lval_text_new(LVAL_STR, len);
+        for (int i = 0, at = 0; i < a->count; i++) {
+            memcpy(x->str + at, a->cell[i]->str, a->cell[i]->len);
+            at += a->cell[i]->len;
+        }
+
+        lval_del(a); return x;
+    }
+
     lval* x = lval_pop(a, 0);
     while (a->count) {
         x = lval_join(x, lval_pop(a, 0));
@@ -959,6 +2826,21 @@ lval* builtin_join(lenv* e, lval* a) {
 /* takes a value and a Q-Expression and appends it to the front */
 lval* builtin_cons(lenv* e, lval* a) {
     LASSERT_NUM("cons", a, 2);
+
+    /* vectors add the value in front, or each element of a Q-Expression */
+    if (a->cell[1]->type == LVAL_VEC) {
+        lval* v = lval_pop(a, 1);
+        lval* x = lval_take(a, 0);
+        if (x->type == LVAL_QEXPR) {
+            for (int i = x->count - 1; i >= 0; i--) {
+                v = lval_vec_cons(lval_copy(x->cell[i]), v);
+            }
+            lval_del(x);
+        } else {
+            v = lval_vec_cons(x, v);
+        }
+        return v;
+    }
     LASSERT_TYPE("cons", a, 1, LVAL_QEXPR);
 
     lval* x = lval_qexpr();
@@ -977,9 +2859,17 @@ lval* builtin_cons(lenv* e, lval* a) {
 /* returns the number of elements in a Q-Expression */
 lval* builtin_len(lenv* e, lval* a) {
     LASSERT_NUM("len", a, 1);
-    LASSERT_TYPE("len", a, 0, LVAL_QEXPR);
-
-    lval* n = lval_long(a->cell[0]->count);
+    int type = a->cell[0]->type;
+    LASSERT(a, (type == LVAL_QEXPR) | (type == LVAL_STR) | (type == LVAL_ARR) |
+        (type == LVAL_VEC) | (type == LVAL_MAP) | (type == LVAL_SB),
+        "Function 'len' expected a String, a Q-expression, an Array, a Vector, "
+        "a Hash Map or a String Builder");
+
+    /* strings, arrays, vectors, maps and builders know their length */
+    lval* n = lval_long(type == LVAL_STR ? a->cell[0]->len :
+        type == LVAL_SB ? a->cell[0]->slen :
+        type == LVAL_ARR ? a->cell[0]->size :
+        type == LVAL_MAP ? a->cell[0]->mcount : lval_seq_count(a->cell[0]));
 
     lval_del(a); return n;
 }
@@ -991,118 +2881,767 @@ lval* builtin_init(lenv* e, lval* a) {
 
     if (a->cell[0]->type == LVAL_QEXPR) {
         lval* v = lval_take(a, 0);
-        lval_del(lval_pop(v, v->count-1));
-        return v;
+        return lval_slice(v, 0, v->count - 1);
+    }
+    else if (a->cell[0]->type == LVAL_VEC) {
+        lval* v = lval_take(a, 0);
+        return lval_vec_slice(v, 0, v->vcount - 1);
     }
     else if (a->cell[0]->type == LVAL_STR) {
-        if (strcmp(a->cell[0]->str, "") == 0) {
-            lval_del(a);
-            return lval_err("Function 'init' cannot process \"\"");
-        }
-        char* s = a->cell[0]->str;
-        char text[strlen(s)];
-        int i;
-
-        for (i = 0; s[i+1] != '\0'; ++i) { text[i] = s[i]; }
-        text[i] = '\0';
-
-        lval_del(a); return lval_str(text);
+        lval* s = lval_take(a, 0);
+        return lval_substr(s, 0, s->len - 1);
     }
 
     lval_del(a);
-    return lval_err("Function 'init' expected a String or a Q-expression");
+    return lval_err("Function 'init' expected a String, a Q-expression or a Vector");
 }
 
 /* returns the element from a specific index in the list */
 lval* builtin_index(lenv* e, lval* a) {
     LASSERT_NUM("index", a, 2);
     LASSERT_TYPE("index", a, 0, LVAL_LONG);
-    LASSERT_TYPE("index", a, 1, LVAL_QEXPR);
+    LASSERT_SEQ("index", a, 1);
     LASSERT_NOT_EMPTY("index", a, 1);
 
     int index = a->cell[0]->num;
     lval* list = lval_take(a, 1);
+    int count = lval_seq_count(list);
     /* error checking, controls if index is a valid positive number */
-    if ((list->count <= index) | (index < 0)) {
-        return lval_err("index out of range, the list has length %i", list->count);
+    if ((count <= index) | (index < 0)) {
+        lval_del(list);
+        return lval_err("index out of range, the list has length %i", count);
     }
 
-    lval* n = lval_take(list, index);
-    lval* v = lval_qexpr();
-    lval_add(v, n);
+    /* the element is returned in a view of the list */
+    if (list->type == LVAL_VEC) { return lval_vec_slice(list, index, index + 1); }
+    return lval_slice(list, index, index + 1);
+}
 
-    return v;
+/* convert a Q-Expression into a vector */
+lval* builtin_vec(lenv* e, lval* a) {
+    LASSERT_NUM("vec", a, 1);
+    LASSERT(a, (a->cell[0]->type == LVAL_QEXPR) | (a->cell[0]->type == LVAL_VEC),
+        "Function 'vec' expected a Q-expression or a Vector");
+
+    if (a->cell[0]->type == LVAL_VEC) { return lval_take(a, 0); }
+    lval* v = lval_vec_from_list(a->cell[0]);
+    lval_del(a); return v;
 }
 
-/* curry function, insert values in a qexpr */
-lval* builtin_pack(lenv* e, lval* a) {
-    LASSERT_TYPE("pack", a, 0, LVAL_FUN);
+/* add a value at the end of a vector */
+lval* builtin_push(lenv* e, lval* a) {
+    LASSERT_NUM("push", a, 2);
+    LASSERT_TYPE("push", a, 1, LVAL_VEC);
 
-    lval* eval = lval_sexpr();
-    lval_add(eval, lval_pop(a, 0));
-    lval* packed = lval_qexpr();
+    lval* v = lval_pop(a, 1);
+    return lval_vec_push(v, lval_take(a, 0));
+}
 
-    /* extract every value after the function into the qexpr */
-    while (a->count) {
-        lval_add(packed, lval_pop(a, 0));
-    }
-    lval_add(eval, packed);
+/* a vector with the element at an index replaced by a value */
+lval* builtin_update(lenv* e, lval* a) {
+    LASSERT_NUM("update", a, 3);
+    LASSERT_TYPE("update", a, 0, LVAL_LONG);
+    LASSERT_TYPE("update", a, 2, LVAL_VEC);
+
+    long index = a->cell[0]->num;
+    int count = a->cell[2]->vcount;
+    LASSERT(a, (index >= 0) & (index < count),
+        "index out of range, the vector has length %i", count);
 
-    lval_del(a); return lval_eval_sexpr(e, eval);
+    lval* v = lval_pop(a, 2);
+    return lval_vec_set(v, index, lval_take(a, 1));
 }
 
-/* uncurry function, extract values from a qexpr */
-lval* builtin_unpack(lenv* e, lval* a) {
-    LASSERT_NUM("unpack", a, 2);
-    LASSERT_TYPE("unpack", a, 0, LVAL_FUN);
-    LASSERT_TYPE("unpack", a, 1, LVAL_QEXPR);
-    LASSERT_NOT_EMPTY("unpack", a, 1);
+/* List combinators */
 
-    lval* eval = lval_sexpr();
-    lval_add(eval, lval_pop(a, 0));
-    lval* x = lval_take(a, 0);
+/* an element of a list as 'fst' gives it, evaluated on its own */
+lval* llist_elem(lenv* e, lval* l, int i) {
+    return lval_eval(e, lval_copy(lval_seq_get(l, i)));
+}
 
-    /* extract every value into the sexpr then evaluate it */
-    while (x->count) {
-        lval_add(eval, lval_pop(x, 0));
-    }
+/* the elements from 'i' up to 'j' of a list or a vector, without copying them */
+lval* lval_seq_slice(lval* v, int i, int j) {
+    return v->type == LVAL_VEC ? lval_vec_slice(v, i, j) : lval_slice(v, i, j);
+}
 
-    lval_del(x); return lval_eval_sexpr(e, eval);
+/* apply 'f' to one or two values that are already evaluated */
+lval* lval_call(lenv* e, lval* f, lval* x, lval* y) {
+    lval* v = lval_add(lval_sexpr(), lval_copy(f));
+    lval_add(v, x);
+    if (y) { lval_add(v, y); }
+    return lval_apply(e, v);
 }
 
-/* print out all the named values in the environment */
-lval* builtin_env(lenv* e, lval* a) {
-    lval* x = lval_qexpr();
+/* apply a function to every element of a list */
+lval* builtin_map(lenv* e, lval* a) {
+    LASSERT_NUM("map", a, 2);
+    LASSERT_SEQ("map", a, 1);
 
-    for (int i = 0; i < e->count; i++) {
-        /* copy each var from the env */
-        lval* y = lval_sym(e->syms[i]);
-        x = lval_add(x, y);
+    lval* l = a->cell[1];
+    int n = lval_seq_count(l);
+    lval* x = lval_qexpr();
+    x->cell = lcell_alloc(n);
+    for (int i = 0; i < n; i++) {
+        lval* r = lval_call(e, a->cell[0], llist_elem(e, l, i), NULL);
+        if (r->type == LVAL_ERR) { lval_del(x); lval_del(a); return r; }
+        x->cell[x->count++] = r;
     }
+    lval_del(a); return x;
+}
 
+/* the elements of a list for which a function returns true */
+lval* builtin_filter(lenv* e, lval* a) {
+    LASSERT_NUM("filter", a, 2);
+    LASSERT_SEQ("filter", a, 1);
+
+    lval* l = a->cell[1];
+    lval* x = lval_qexpr();
+    for (int i = 0; i < lval_seq_count(l); i++) {
+        lval* r = lval_call(e, a->cell[0], llist_elem(e, l, i), NULL);
+        if (r->type != LVAL_LONG) {
+            lval* err = r->type == LVAL_ERR ? r : lval_err(
+                "Function 'filter' expected the condition to return %s. Got %s.",
+                ltype_name(LVAL_LONG), ltype_name(r->type));
+            if (err != r) { lval_del(r); }
+            lval_del(x); lval_del(a); return err;
+        }
+        if (r->num) { x = lval_add(x, lval_copy(lval_seq_get(l, i))); }
+        lval_del(r);
+    }
     lval_del(a); return x;
 }
 
-/* definition of lambda function */
-lval* builtin_lambda(lenv* e, lval* a) {
-    /* Check Two arguments, each of which are Q-Expressions */
-    LASSERT_NUM("\\", a, 2);
-    LASSERT_TYPE("\\", a, 0, LVAL_QEXPR);
-    LASSERT_TYPE("\\", a, 1, LVAL_QEXPR);
+/* combine the elements of a list with a function, from the left or from the right */
+lval* builtin_fold_list(lenv* e, lval* a, char* func, int right) {
+    LASSERT_NUM(func, a, 3);
+    LASSERT_SEQ(func, a, 2);
+
+    lval* l = a->cell[2];
+    int n = lval_seq_count(l);
+    lval* z = lval_copy(a->cell[1]);
+    for (int i = 0; i < n && z->type != LVAL_ERR; i++) {
+        z = right
+            ? lval_call(e, a->cell[0], llist_elem(e, l, n - 1 - i), z)
+            : lval_call(e, a->cell[0], z, llist_elem(e, l, i));
+    }
+    lval_del(a); return z;
+}
 
-    /* Check first Q-Expression contains only Symbols */
-    for (int i = 0; i < a->cell[0]->count; i++) {
-        LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
-            "Cannot define non-symbol. Got %s, Expected %s.",
-            ltype_name(a->cell[0]->cell[i]->type),ltype_name(LVAL_SYM));
+lval* builtin_foldl(lenv* e, lval* a) { return builtin_fold_list(e, a, "foldl", 0); }
+lval* builtin_foldr(lenv* e, lval* a) { return builtin_fold_list(e, a, "foldr", 1); }
+
+/* the elements of a list in the opposite order */
+lval* builtin_reverse(lenv* e, lval* a) {
+    LASSERT_NUM("reverse", a, 1);
+    LASSERT_SEQ("reverse", a, 0);
+
+    lval* l = a->cell[0];
+    int n = lval_seq_count(l);
+    lval* x = lval_qexpr();
+    x->count = n;
+    x->cell = lcell_alloc(n);
+    for (int i = 0; i < n; i++) {
+        x->cell[i] = lval_copy(lval_seq_get(l, n - 1 - i));
     }
+    lval_del(a); return x;
+}
 
-    /* Pop first two arguments and pass them to lval_lambda */
-    lval* formals = lval_pop(a, 0);
-    lval* body = lval_pop(a, 0);
-    lval_del(a);
+/* the element at an index, evaluated like 'fst' does */
+lval* builtin_nth(lenv* e, lval* a) {
+    LASSERT_NUM("nth", a, 2);
+    LASSERT_TYPE("nth", a, 0, LVAL_LONG);
+    LASSERT_SEQ("nth", a, 1);
 
-    return lval_lambda(formals, body);
+    long n = a->cell[0]->num;
+    int count = lval_seq_count(a->cell[1]);
+    LASSERT(a, (n >= 0) & (n < count),
+        "index out of range, the list has length %i", count);
+
+    lval* x = llist_elem(e, a->cell[1], n);
+    lval_del(a); return x;
+}
+
+/* the last element, evaluated like 'fst' does */
+lval* builtin_last(lenv* e, lval* a) {
+    LASSERT_NUM("last", a, 1);
+    LASSERT_SEQ("last", a, 0);
+    LASSERT_NOT_EMPTY("last", a, 0);
+
+    lval* x = llist_elem(e, a->cell[0], lval_seq_count(a->cell[0]) - 1);
+    lval_del(a); return x;
+}
+
+/* check the arguments of 'take', 'drop' and 'split', a count within the list */
+lval* builtin_cut_check(lval* a, char* func) {
+    LASSERT_NUM(func, a, 2);
+    LASSERT_TYPE(func, a, 0, LVAL_LONG);
+    LASSERT_SEQ(func, a, 1);
+
+    long n = a->cell[0]->num;
+    int count = lval_seq_count(a->cell[1]);
+    LASSERT(a, (n >= 0) & (n <= count),
+        "Function '%s' cannot cut %li elements from a list of length %i", func, n, count);
+    return NULL;
+}
+
+/* the first n elements of a list */
+lval* builtin_take(lenv* e, lval* a) {
+    lval* err = builtin_cut_check(a, "take");
+    if (err) { return err; }
+    long n = a->cell[0]->num;
+    return lval_seq_slice(lval_take(a, 1), 0, n);
+}
+
+/* all but the first n elements of a list */
+lval* builtin_drop(lenv* e, lval* a) {
+    lval* err = builtin_cut_check(a, "drop");
+    if (err) { return err; }
+    long n = a->cell[0]->num;
+    lval* l = lval_take(a, 1);
+    return lval_seq_slice(l, n, lval_seq_count(l));
+}
+
+/* a list of what 'take' and 'drop' return */
+lval* builtin_split(lenv* e, lval* a) {
+    lval* err = builtin_cut_check(a, "split");
+    if (err) { return err; }
+    long n = a->cell[0]->num;
+    lval* l = lval_take(a, 1);
+    lval* x = lval_qexpr();
+    x = lval_add(x, lval_seq_slice(lval_copy(l), 0, n));
+    x = lval_add(x, lval_seq_slice(l, n, lval_seq_count(l)));
+    return x;
+}
+
+/* pairs of the elements at the same index of two lists, as long as the shorter */
+lval* builtin_zip(lenv* e, lval* a) {
+    LASSERT_NUM("zip", a, 2);
+    LASSERT_SEQ("zip", a, 0);
+    LASSERT_SEQ("zip", a, 1);
+
+    int n = lval_seq_count(a->cell[0]);
+    if (lval_seq_count(a->cell[1]) < n) { n = lval_seq_count(a->cell[1]); }
+
+    lval* x = lval_qexpr();
+    x->count = n;
+    x->cell = lcell_alloc(n);
+    for (int i = 0; i < n; i++) {
+        lval* p = lval_qexpr();
+        p = lval_add(p, lval_copy(lval_seq_get(a->cell[0], i)));
+        p = lval_add(p, lval_copy(lval_seq_get(a->cell[1], i)));
+        x->cell[i] = p;
+    }
+    lval_del(a); return x;
+}
+
+/* a list of pairs into the list of their first elements and the list of the rest */
+lval* builtin_unzip(lenv* e, lval* a) {
+    LASSERT_NUM("unzip", a, 1);
+    LASSERT_SEQ("unzip", a, 0);
+
+    lval* l = a->cell[0];
+    lval* fst = lval_qexpr();
+    lval* rest = lval_qexpr();
+    for (int i = 0; i < lval_seq_count(l); i++) {
+        lval* p = llist_elem(e, l, i);
+        if (((p->type != LVAL_QEXPR) & (p->type != LVAL_VEC)) || lval_empty(p)) {
+            lval* err = p->type == LVAL_ERR ? lval_copy(p) : lval_err(
+                "Function 'unzip' expected a list of pairs. Got %s.", ltype_name(p->type));
+            lval_del(p); lval_del(fst); lval_del(rest); lval_del(a);
+            return err;
+        }
+        fst = lval_add(fst, lval_copy(lval_seq_get(p, 0)));
+        for (int j = 1; j < lval_seq_count(p); j++) {
+            rest = lval_add(rest, lval_copy(lval_seq_get(p, j)));
+        }
+        lval_del(p);
+    }
+    lval_del(a);
+    return lval_add(lval_add(lval_qexpr(), fst), rest);
+}
+
+/* true if a value is equal to an element of a list */
+lval* builtin_elem(lenv* e, lval* a) {
+    LASSERT_NUM("elem", a, 2);
+    LASSERT_SEQ("elem", a, 1);
+
+    lval* l = a->cell[1];
+    for (int i = 0; i < lval_seq_count(l); i++) {
+        lval* y = llist_elem(e, l, i);
+        if (y->type == LVAL_ERR) { lval_del(a); return y; }
+        int found = lval_eq(a->cell[0], y);
+        lval_del(y);
+        if (found) { lval_del(a); return lval_long(1); }
+    }
+    lval_del(a); return lval_long(0);
+}
+
+/* the value paired with a key in a list of pairs */
+lval* builtin_lookup(lenv* e, lval* a) {
+    LASSERT_NUM("lookup", a, 2);
+    LASSERT_SEQ("lookup", a, 1);
+
+    lval* l = a->cell[1];
+    for (int i = 0; i < lval_seq_count(l); i++) {
+        lval* p = llist_elem(e, l, i);
+        if (((p->type != LVAL_QEXPR) & (p->type != LVAL_VEC)) || lval_seq_count(p) < 2) {
+            lval* err = p->type == LVAL_ERR ? lval_copy(p) : lval_err(
+                "Function 'lookup' expected a list of pairs. Got %s.", ltype_name(p->type));
+            lval_del(p); lval_del(a);
+            return err;
+        }
+        lval* key = llist_elem(e, p, 0);
+        int found = lval_eq(key, a->cell[0]);
+        lval_del(key);
+        if (found) {
+            lval* x = llist_elem(e, p, 1);
+            lval_del(p); lval_del(a); return x;
+        }
+        lval_del(p);
+    }
+    lval_del(a);
+    return lval_err("No Element Found");
+}
+
+/* a hash map from a list of {key value} pairs */
+lval* builtin_hash(lenv* e, lval* a) {
+    LASSERT_NUM("hash", a, 1);
+    LASSERT_SEQ("hash", a, 0);
+
+    lval* l = a->cell[0];
+    lval* m = lval_map();
+    for (int i = 0; i < lval_seq_count(l); i++) {
+        lval* p = lval_seq_get(l, i);
+        uint64_t h;
+        if (((p->type != LVAL_QEXPR) & (p->type != LVAL_VEC)) || lval_seq_count(p) != 2) {
+            lval_del(m); lval_del(a);
+            return lval_err("Function 'hash' expected a list of {key value} pairs");
+        }
+        if (!lhash_key(lval_seq_get(p, 0), &h)) {
+            lval* err = lval_err("Function 'hash' cannot use %s as a key.",
+                ltype_name(lval_seq_get(p, 0)->type));
+            lval_del(m); lval_del(a); return err;
+        }
+        lmap_put(m, lval_copy(lval_seq_get(p, 0)), lval_copy(lval_seq_get(p, 1)), h);
+    }
+    lval_del(a); return m;
+}
+
+/* the value bound to a key, or the default when given and the key is missing */
+lval* builtin_hash_get(lenv* e, lval* a) {
+    LASSERT(a, (a->count == 2) | (a->count == 3),
+        "Function 'get' passed incorrect number of arguments. Got %i, Expected 2 or 3.",
+        a->count);
+    LASSERT_TYPE("get", a, 1, LVAL_MAP);
+    uint64_t h;
+    LASSERT_KEY("get", a, 0, h);
+
+    lval* m = a->cell[1];
+    lslot* s = &m->slots[lmap_find(m, a->cell[0], h)];
+    if (s->key) {
+        lval* x = lval_copy(s->val);
+        lval_del(a); return x;
+    }
+    if (a->count == 3) { return lval_take(a, 2); }
+    lval_del(a);
+    return lval_err("Key not found in the hash map");
+}
+
+/* true if 'm' is 'v' or found inside it. 'put!' changes maps in place, storing one
+   where it can reach itself would make a cycle that is never reclaimed */
+int lval_holds(lval* v, lval* m) {
+    if (v == m) { return 1; }
+    switch (v->type) {
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            for (int i = 0; i < v->count; i++) {
+                if (lval_holds(v->cell[i], m)) { return 1; }
+            }
+            return 0;
+        case LVAL_VEC:
+            for (int i = 0; i < v->vcount; i++) {
+                if (lval_holds(lval_vec_get(v, i), m)) { return 1; }
+            }
+            return 0;
+        case LVAL_MAP:
+            for (int i = 0; i < v->mcap; i++) {
+                if (v->slots[i].key && lval_holds(v->slots[i].val, m)) { return 1; }
+            }
+            return 0;
+        case LVAL_FUN:
+            return !v->builtin && (v->flags & LFUN_PARTIAL) && lval_holds(v->args, m);
+    }
+    return 0;
+}
+
+/* bind a key to a value. 'put!' changes the map given, 'put' a copy of it when
+   the map is shared */
+lval* builtin_hash_store(lval* a, char* func, int in_place) {
+    LASSERT_NUM(func, a, 3);
+    LASSERT_TYPE(func, a, 2, LVAL_MAP);
+    uint64_t h;
+    LASSERT_KEY(func, a, 0, h);
+    LASSERT(a, !in_place || !lval_holds(a->cell[1], a->cell[2]),
+        "Function '%s' cannot store a Hash Map inside itself", func);
+
+    lval* m = in_place ? lval_copy(a->cell[2]) : lval_own(lval_pop(a, 2));
+    lmap_put(m, lval_copy(a->cell[0]), lval_copy(a->cell[1]), h);
+    lval_del(a); return m;
+}
+
+lval* builtin_hash_put(lenv* e, lval* a) { return builtin_hash_store(a, "put", 0); }
+lval* builtin_hash_put_inplace(lenv* e, lval* a) { return builtin_hash_store(a, "put!", 1); }
+
+/* unbind a key if present, as 'put' and 'put!' do */
+lval* builtin_hash_unbind(lval* a, char* func, int in_place) {
+    LASSERT_NUM(func, a, 2);
+    LASSERT_TYPE(func, a, 1, LVAL_MAP);
+    uint64_t h;
+    LASSERT_KEY(func, a, 0, h);
+
+    lval* m = in_place ? lval_copy(a->cell[1]) : lval_own(lval_pop(a, 1));
+    int i = lmap_find(m, a->cell[0], h);
+    if (m->slots[i].key) { lmap_remove(m, i); }
+    lval_del(a); return m;
+}
+
+lval* builtin_hash_remove(lenv* e, lval* a) { return builtin_hash_unbind(a, "remove", 0); }
+lval* builtin_hash_remove_inplace(lenv* e, lval* a) { return builtin_hash_unbind(a, "remove!", 1); }
+
+/* true if a key is bound in the map */
+lval* builtin_hash_has(lenv* e, lval* a) {
+    LASSERT_NUM("has", a, 2);
+    LASSERT_TYPE("has", a, 1, LVAL_MAP);
+    uint64_t h;
+    LASSERT_KEY("has", a, 0, h);
+
+    lval* m = a->cell[1];
+    lval* x = lval_long(m->slots[lmap_find(m, a->cell[0], h)].key != NULL);
+    lval_del(a); return x;
+}
+
+/* the keys or the values of a map in a Q-Expression */
+lval* builtin_hash_entries(lval* a, char* func, int values) {
+    LASSERT_NUM(func, a, 1);
+    LASSERT_TYPE(func, a, 0, LVAL_MAP);
+
+    lval* m = a->cell[0];
+    lval* x = lval_qexpr();
+    x->cell = lcell_alloc(m->mcount);
+    for (int i = 0; i < m->mcap; i++) {
+        if (!m->slots[i].key) { continue; }
+        x->cell[x->count++] = lval_copy(values ? m->slots[i].val : m->slots[i].key);
+    }
+    lval_del(a); return x;
+}
+
+lval* builtin_hash_keys(lenv* e, lval* a) { return builtin_hash_entries(a, "keys", 0); }
+lval* builtin_hash_values(lenv* e, lval* a) { return builtin_hash_entries(a, "values", 1); }
+
+/* combine the entries of a map with a function of the result so far, a key and its value */
+lval* builtin_fold_hash(lenv* e, lval* a) {
+    LASSERT_NUM("fold-hash", a, 3);
+    LASSERT_TYPE("fold-hash", a, 2, LVAL_MAP);
+
+    /* the function may change the map with 'put!', so the entries are taken first
+       and it sees those there when it started */
+    lval* m = a->cell[2];
+    int n = 0;
+    lslot* entries = malloc(sizeof(lslot) * (m->mcount ? m->mcount : 1));
+    for (int i = 0; i < m->mcap; i++) {
+        if (!m->slots[i].key) { continue; }
+        entries[n].key = lval_copy(m->slots[i].key);
+        entries[n++].val = lval_copy(m->slots[i].val);
+    }
+
+    lval* z = lval_copy(a->cell[1]);
+    for (int i = 0; i < n; i++) {
+        if (z->type == LVAL_ERR) {
+            lval_del(entries[i].key); lval_del(entries[i].val);
+            continue;
+        }
+        lval* c = lval_add(lval_sexpr(), lval_copy(a->cell[0]));
+        lval_add(c, z);
+        lval_add(c, entries[i].key);
+        lval_add(c, entries[i].val);
+        z = lval_apply(e, c);
+    }
+    free(entries);
+    lval_del(a); return z;
+}
+
+/* add strings, numbers or the text of other builders to a builder, changing it.
+   'first' is the position of the first of them among the arguments */
+lval* builtin_sb_append(lval* b, lval* a, char* func, int first) {
+    for (int i = 0; i < a->count; i++) {
+        int t = a->cell[i]->type;
+        if ((t != LVAL_STR) & (t != LVAL_SB) & (t != LVAL_LONG) & (t != LVAL_DOUBLE)) {
+            lval* err = lval_err("Function '%s' passed incorrect type for argument %i. "
+                "Got %s, Expected a String, a Number or a String Builder.", func, first + i, ltype_name(t));
+            lval_del(b); lval_del(a); return err;
+        }
+    }
+
+    for (int i = 0; i < a->count; i++) {
+        lval* x = a->cell[i];
+        char num[64];
+        switch (x->type) {
+            case LVAL_STR: lval_sb_add(b, lval_copy(x)); break;
+            case LVAL_LONG:
+                lval_sb_add(b, lval_text(LVAL_STR, num, snprintf(num, sizeof(num), "%li", x->num)));
+            break;
+            case LVAL_DOUBLE:
+                lval_sb_add(b, lval_text(LVAL_STR, num, snprintf(num, sizeof(num), "%f", x->dec)));
+            break;
+            /* parts are only read, a builder can be added to itself */
+            case LVAL_SB:
+                for (int j = 0, n = x->nparts; j < n; j++) {
+                    lval_sb_add(b, lval_copy(x->parts[j]));
+                }
+            break;
+        }
+    }
+    lval_del(a); return b;
+}
+
+/* a new builder holding the arguments */
+lval* builtin_sb(lenv* e, lval* a) {
+    return builtin_sb_append(lval_sb(), a, "sb", 0);
+}
+
+/* add the rest of the arguments at the end of the builder given first. 'sb-add!'
+   changes that builder, 'sb-add' a copy of it when the builder is shared */
+lval* builtin_sb_extend(lval* a, char* func, int in_place) {
+    LASSERT(a, a->count > 0,
+        "Function '%s' passed incorrect number of arguments. Got 0, Expected 1 or more.", func);
+    LASSERT_TYPE(func, a, 0, LVAL_SB);
+
+    lval* b = lval_pop(a, 0);
+    return builtin_sb_append(in_place ? b : lval_own(b), a, func, 1);
+}
+
+lval* builtin_sb_add(lenv* e, lval* a) { return builtin_sb_extend(a, "sb-add", 0); }
+lval* builtin_sb_add_inplace(lenv* e, lval* a) { return builtin_sb_extend(a, "sb-add!", 1); }
+
+/* the text of a builder as a string */
+lval* builtin_sb_str(lenv* e, lval* a) {
+    LASSERT_NUM("sb-str", a, 1);
+    LASSERT_TYPE("sb-str", a, 0, LVAL_SB);
+
+    lval* s = lval_sb_str(a->cell[0]);
+    lval_del(a); return s;
+}
+
+/* check that argument 'index' is a file still open for reading or writing */
+lval* builtin_file_check(lval* a, char* func, int index, int writing) {
+    LASSERT_TYPE(func, a, index, LVAL_FILE);
+    lfile* f = a->cell[index]->file;
+    LASSERT(a, f->fp, "Function '%s' passed a closed file", func);
+    LASSERT(a, f->writing == writing, "Function '%s' passed a file open for %s",
+        func, f->writing ? "writing" : "reading");
+    return NULL;
+}
+
+/* open a file for reading, writing or appending */
+lval* builtin_open(lenv* e, lval* a) {
+    LASSERT_NUM("open", a, 2);
+    LASSERT_TYPE("open", a, 0, LVAL_STR);
+    LASSERT_TYPE("open", a, 1, LVAL_STR);
+    a = lval_arg_cstr(lval_arg_cstr(a, 0), 1);
+
+    /* files are opened in binary mode so bytes come back as they were written */
+    char* mode = a->cell[1]->str;
+    char* modes[] = { "r", "w", "a" };
+    char* binary[] = { "rb", "wb", "ab" };
+    int m = 0;
+    while (m < 3 && strcmp(mode, modes[m])) { m++; }
+    LASSERT(a, m < 3, "Function 'open' expected mode \"r\", \"w\" or \"a\". Got \"%s\".", mode);
+
+    FILE* fp = fopen(a->cell[0]->str, binary[m]);
+    LASSERT(a, fp, "Could not open file %s: %s", a->cell[0]->str, strerror(errno));
+
+    lval* x = lval_file(fp, a->cell[0]->str, m > 0);
+    lval_del(a); return x;
+}
+
+/* close a file, writing what is still buffered */
+lval* builtin_close(lenv* e, lval* a) {
+    LASSERT_NUM("close", a, 1);
+    LASSERT_TYPE("close", a, 0, LVAL_FILE);
+
+    lfile_close(a->cell[0]->file);
+    lval_del(a); return lval_sexpr();
+}
+
+/* the next line of a file without its newline, {} at the end */
+lval* builtin_read_line(lenv* e, lval* a) {
+    LASSERT_NUM("read-line", a, 1);
+    lval* err = builtin_file_check(a, "read-line", 0, 0);
+    if (err) { return err; }
+
+    lval* x = lfile_line(a->cell[0]->file);
+    lval_del(a);
+    return x ? x : lval_qexpr();
+}
+
+/* up to a number of bytes from a file, {} at the end */
+lval* builtin_read_chunk(lenv* e, lval* a) {
+    LASSERT_NUM("read-chunk", a, 2);
+    lval* err = builtin_file_check(a, "read-chunk", 0, 0);
+    if (err) { return err; }
+    LASSERT_TYPE("read-chunk", a, 1, LVAL_LONG);
+    LASSERT(a, a->cell[1]->num > 0, "Function 'read-chunk' expected a positive size");
+
+    lval* x = lfile_chunk(a->cell[0]->file, a->cell[1]->num);
+    lval_del(a);
+    return x ? x : lval_qexpr();
+}
+
+/* write strings, numbers and the text of string builders to a file */
+lval* builtin_write(lenv* e, lval* a) {
+    LASSERT(a, a->count > 0,
+        "Function 'write' passed incorrect number of arguments. Got 0, Expected 1 or more.");
+    lval* err = builtin_file_check(a, "write", 0, 1);
+    if (err) { return err; }
+
+    FILE* fp = a->cell[0]->file->fp;
+    for (int i = 1; i < a->count; i++) {
+        lval* x = a->cell[i];
+        switch (x->type) {
+            case LVAL_STR: fwrite(x->str, 1, x->len, fp); break;
+            case LVAL_LONG: fprintf(fp, "%li", x->num); break;
+            case LVAL_DOUBLE: fprintf(fp, "%f", x->dec); break;
+            /* the parts of a builder are written without joining them first */
+            case LVAL_SB:
+                for (int j = 0; j < x->nparts; j++) {
+                    fwrite(x->parts[j]->str, 1, x->parts[j]->len, fp);
+                }
+            break;
+            default: {
+                lval* err = lval_err("Function 'write' passed incorrect type for argument %i. "
+                    "Got %s, Expected a String, a Number or a String Builder.",
+                    i, ltype_name(x->type));
+                lval_del(a); return err;
+            }
+        }
+    }
+    LASSERT(a, !ferror(fp), "Could not write file %s: %s",
+        a->cell[0]->file->name, strerror(errno));
+    lval_del(a); return lval_sexpr();
+}
+
+/* combine the lines of a file with a function, reading one at a time. A file
+   name is opened and closed around the fold */
+lval* builtin_fold_lines(lenv* e, lval* a) {
+    LASSERT_NUM("fold-lines", a, 3);
+    lval* file;
+    if (a->cell[2]->type == LVAL_STR) {
+        a = lval_arg_cstr(a, 2);
+        FILE* fp = fopen(a->cell[2]->str, "rb");
+        LASSERT(a, fp, "Could not open file %s: %s", a->cell[2]->str, strerror(errno));
+        file = lval_file(fp, a->cell[2]->str, 0);
+    } else {
+        lval* err = builtin_file_check(a, "fold-lines", 2, 0);
+        if (err) { return err; }
+        file = lval_copy(a->cell[2]);
+    }
+
+    lval* z = lval_copy(a->cell[1]);
+    lval* line;
+    while (z->type != LVAL_ERR && file->file->fp && (line = lfile_line(file->file))) {
+        z = lval_call(e, a->cell[0], z, line);
+    }
+    if (a->cell[2]->type == LVAL_STR) { lfile_close(file->file); }
+    lval_del(file);
+    lval_del(a); return z;
+}
+
+/* curry function, build the call with the values inserted in a qexpr */
+lval* builtin_pack_expr(lval* a) {
+    LASSERT_TYPE("pack", a, 0, LVAL_FUN);
+
+    lval* eval = lval_sexpr();
+    lval_add(eval, lval_pop(a, 0));
+    lval* packed = lval_qexpr();
+
+    /* extract every value after the function into the qexpr */
+    while (a->count) {
+        lval_add(packed, lval_pop(a, 0));
+    }
+    lval_add(eval, packed);
+
+    lval_del(a); return eval;
+}
+
+/* curry function, insert values in a qexpr */
+lval* builtin_pack(lenv* e, lval* a) {
+    lval* x = builtin_pack_expr(a);
+    return x->type == LVAL_ERR ? x : lval_eval_sexpr(e, x);
+}
+
+/* uncurry function, build the call with the values extracted from a qexpr */
+lval* builtin_unpack_expr(lval* a) {
+    LASSERT_NUM("unpack", a, 2);
+    LASSERT_TYPE("unpack", a, 0, LVAL_FUN);
+    LASSERT_SEQ("unpack", a, 1);
+    LASSERT_NOT_EMPTY("unpack", a, 1);
+
+    lval* eval = lval_sexpr();
+    lval_add(eval, lval_pop(a, 0));
+    lval* x = lval_take(a, 0);
+    if (x->type == LVAL_VEC) {
+        lval* l = lval_vec_to_list(x);
+        lval_del(x); x = l;
+    }
+    x = lval_own(x);
+
+    /* extract every value into the sexpr then evaluate it */
+    while (x->count) {
+        lval_add(eval, lval_pop(x, 0));
+    }
+
+    lval_del(x); return eval;
+}
+
+/* uncurry function, extract values from a qexpr */
+lval* builtin_unpack(lenv* e, lval* a) {
+    lval* x = builtin_unpack_expr(a);
+    return x->type == LVAL_ERR ? x : lval_eval_sexpr(e, x);
+}
+
+/* print out all the named values in the environment */
+lval* builtin_env(lenv* e, lval* a) {
+    lval* x = lval_qexpr();
+
+    for (int i = 0; i < e->count; i++) {
+        /* copy each var from the env */
+        lval* y = lval_sym(e->syms[i]);
+        x = lval_add(x, y);
+    }
+
+    lval_del(a); return x;
+}
+
+/* definition of lambda function */
+lval* builtin_lambda(lenv* e, lval* a) {
+    /* Check Two arguments, each of which are Q-Expressions */
+    LASSERT_NUM("\\", a, 2);
+    LASSERT_TYPE("\\", a, 0, LVAL_QEXPR);
+    LASSERT_TYPE("\\", a, 1, LVAL_QEXPR);
+
+    /* Check first Q-Expression contains only Symbols */
+    for (int i = 0; i < a->cell[0]->count; i++) {
+        LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
+            "Cannot define non-symbol. Got %s, Expected %s.",
+            ltype_name(a->cell[0]->cell[i]->type),ltype_name(LVAL_SYM));
+    }
+
+    /* Pop first two arguments and pass them to lval_lambda */
+    lval* formals = lval_pop(a, 0);
+    lval* body = lval_pop(a, 0);
+    lval_del(a);
+
+    return lval_lambda(e, formals, body);
 }
 
 /* create custom named functions using lambda functions
@@ -1117,202 +3656,896 @@ lval* builtin_fun(lenv* e, lval* a) {
     /* create lambda function that gets called when we call costum function */
     lval* body = lval_pop(a, 1);
     lval* args = builtin_tail(e, (lval_copy(a)));
-    lval* lambda = lval_lambda(args, body);
+    lval* lambda = lval_lambda(e, args, body);
+
+    /* bind custom name to the lambda function in the environment */
+    lval* name = lval_take(builtin_head(e, a), 0);
+    lenv_def(e, name, lambda);
+
+    lval_del(lambda); lval_del(name); return lval_sexpr();
+}
+
+/* reclaim pending memory, optionally setting the collector tunables */
+lval* builtin_gc(lenv* e, lval* a) {
+    LASSERT(a, a->count <= 2,
+        "Function 'gc' passed too many arguments. Got %i, Expected 2.", a->count);
+    for (int i = 0; i < a->count; i++) {
+        LASSERT_TYPE("gc", a, i, LVAL_LONG);
+        LASSERT(a, a->cell[i]->num > 0,
+            "Function 'gc' expects positive numbers for argument %i.", i);
+    }
+
+    /* first the work done per allocation, then the most left pending */
+    if (a->count > 0) { lgc.budget = a->cell[0]->num; }
+    if (a->count > 1) { lgc.limit = a->cell[1]->num; }
+    lval_del(a);
+    lgc_collect();
+
+    /* report {reclaimed budget limit peak} */
+    lval* x = lval_qexpr();
+    lval_add(x, lval_long(lgc.reclaimed));
+    lval_add(x, lval_long(lgc.budget));
+    lval_add(x, lval_long(lgc.limit));
+    lval_add(x, lval_long(lgc.peak));
+    return x;
+}
+
+/* add the statistics of one pool to a list */
+lval* lval_add_pool(lval* x, char* name, long requests, long mallocs) {
+    lval* p = lval_qexpr();
+    lval_add(p, lval_str(name));
+    lval_add(p, lval_long(requests));
+    lval_add(p, lval_long(mallocs));
+    return lval_add(x, p);
+}
+
+/* report allocations handed out and calls made to malloc for each pool */
+lval* builtin_mem(lenv* e, lval* a) {
+    lval_del(a);
+
+    long requests = lcell_large.requests;
+    long mallocs = lcell_large.mallocs;
+    for (int i = 0; i < LCELL_CLASSES; i++) {
+        requests += lcell_pool[i].requests;
+        mallocs += lcell_pool[i].mallocs;
+    }
+
+    long lval_requests = 0, lval_mallocs = 0;
+    for (int i = 0; i < LVAL_SIZES; i++) {
+        lval_requests += lval_pool[i].requests;
+        lval_mallocs += lval_pool[i].mallocs;
+    }
+
+    lval* x = lval_qexpr();
+    lval_add_pool(x, "lval", lval_requests, lval_mallocs);
+    lval_add_pool(x, "lenv", lenv_pool.requests, lenv_pool.mallocs);
+    lval_add_pool(x, "cells", requests, mallocs);
+    return x;
+}
+
+/* exit the program */
+lval* builtin_exit(lenv* e, lval* a) {
+    exit(0);
+}
+
+/* arithmetic operators, in the order of their vm instructions */
+enum { LOP_ADD, LOP_SUB, LOP_MUL, LOP_DIV, LOP_MOD, LOP_MAX, LOP_MIN, LOP_POW };
+
+/* orderings, also in vm order */
+enum { LORD_GT, LORD_LT, LORD_GE, LORD_LE };
+
+lval* larr_op(lval* a, int op);
+lval* larr_ord(lval* a, int op);
+
+/* Integer kernel: fold the operator over 'count' integers into 'acc'.
+   Returns 0 on division by zero */
+int lop_long(int op, long* acc, lval** x, int count) {
+    long n = *acc;
+    switch (op) {
+        case LOP_ADD: for (int i = 0; i < count; i++) { n += x[i]->num; } break;
+        case LOP_SUB: for (int i = 0; i < count; i++) { n -= x[i]->num; } break;
+        case LOP_MUL: for (int i = 0; i < count; i++) { n *= x[i]->num; } break;
+        case LOP_DIV:
+            for (int i = 0; i < count; i++) {
+                long y = x[i]->num;
+                if (y == 0) { return 0; }
+                /* LONG_MIN / -1 traps, negate without overflow instead */
+                n = (y == -1) ? (long)(0UL - (unsigned long)n) : n / y;
+            }
+        break;
+        case LOP_MOD:
+            for (int i = 0; i < count; i++) {
+                long y = x[i]->num;
+                if (y == 0) { return 0; }
+                n = (y == -1) ? 0 : n % y;
+            }
+        break;
+        case LOP_MAX: for (int i = 0; i < count; i++) { if (n < x[i]->num) { n = x[i]->num; } } break;
+        case LOP_MIN: for (int i = 0; i < count; i++) { if (n > x[i]->num) { n = x[i]->num; } } break;
+        case LOP_POW:
+            for (int i = 0; i < count; i++) {
+                if (n == 0 && x[i]->num < 0) { return 0; }
+                n = power(n, x[i]->num);
+            }
+        break;
+    }
+    *acc = n;
+    return 1;
+}
+
+/* Decimal kernel, integers among the operands are read as decimals */
+int lop_double(int op, double* acc, lval** x, int count) {
+    double d = *acc;
+    for (int i = 0; i < count; i++) {
+        double y = lval_to_double(x[i]);
+        switch (op) {
+            case LOP_ADD: d += y; break;
+            case LOP_SUB: d -= y; break;
+            case LOP_MUL: d *= y; break;
+            case LOP_DIV: if (y == 0) { return 0; } d /= y; break;
+            case LOP_MOD: if (y == 0) { return 0; } d = fmod(d, y); break;
+            case LOP_MAX: if (d < y) { d = y; } break;
+            case LOP_MIN: if (d > y) { d = y; } break;
+            case LOP_POW: d = pow(d, y); break;
+        }
+    }
+    *acc = d;
+    return 1;
+}
+
+/* Apply an arithmetic operator to every argument */
+lval* builtin_op(lenv* e, lval* a, int op) {
+
+    /* Ensure all arguments are numbers, and find where decimals start */
+    int first_double = a->count;
+    for (int i = a->count - 1; i >= 0; i--) {
+        int type = a->cell[i]->type;
+        if (type == LVAL_ARR) { return larr_op(a, op); }
+        if ((type != LVAL_LONG) & (type != LVAL_DOUBLE)) {
+            lval_del(a);
+            return lval_err("Cannot operate on non-number!");
+        }
+        if (type == LVAL_DOUBLE) { first_double = i; }
+    }
+
+    /* Integers are folded up to the first decimal, then the rest as decimals */
+    lval* x;
+    if (first_double == 0) {
+        double d = a->cell[0]->dec;
+        if ((op == LOP_SUB) && a->count == 1) { d = -d; }
+        x = lop_double(op, &d, a->cell + 1, a->count - 1)
+            ? lval_double(d) : lval_err("Division By Zero!");
+    } else {
+        long n = a->cell[0]->num;
+        /* If no arguments and sub then perform unary negation */
+        if ((op == LOP_SUB) && a->count == 1) { n = -n; }
+        if (!lop_long(op, &n, a->cell + 1, first_double - 1)) {
+            x = lval_err("Division By Zero!");
+        } else if (first_double == a->count) {
+            x = lval_long(n);
+        } else {
+            double d = (double)n;
+            x = lop_double(op, &d, a->cell + first_double, a->count - first_double)
+                ? lval_double(d) : lval_err("Division By Zero!");
+        }
+    }
+
+    lval_del(a);
+    return x;
+}
+
+/* compare two numbers, integers exactly */
+int lord_long(int op, long p, long q) {
+    switch (op) {
+        case LORD_GT: return p > q;
+        case LORD_LT: return p < q;
+        case LORD_GE: return p >= q;
+        default: return p <= q;
+    }
+}
+
+int lord_double(int op, double p, double q) {
+    switch (op) {
+        case LORD_GT: return p > q;
+        case LORD_LT: return p < q;
+        case LORD_GE: return p >= q;
+        default: return p <= q;
+    }
+}
+
+char* lord_names[] = { ">", "<", ">=", "<=" };
+
+/* conditional functions for number */
+lval* builtin_ord(lenv* e, lval* a, int op) {
+    LASSERT_NUM(lord_names[op], a, 2);
+
+    /* ensure every argument is a number, arrays are compared element-wise */
+    lval* x = a->cell[0];
+    lval* y = a->cell[1];
+    if ((x->type == LVAL_ARR) | (y->type == LVAL_ARR)) {
+        int other = x->type == LVAL_ARR ? y->type : x->type;
+        if ((other == LVAL_ARR) | (other == LVAL_LONG) | (other == LVAL_DOUBLE)) {
+            return larr_ord(a, op);
+        }
+    }
+    if (((x->type != LVAL_LONG) & (x->type != LVAL_DOUBLE)) |
+        ((y->type != LVAL_LONG) & (y->type != LVAL_DOUBLE))) {
+        lval_del(a); return lval_err("Error, %s can only compare numbers", lord_names[op]);
+    }
+
+    int r = (x->type == LVAL_LONG) & (y->type == LVAL_LONG)
+        ? lord_long(op, x->num, y->num)
+        : lord_double(op, lval_to_double(x), lval_to_double(y));
+
+    lval_del(a); return lval_long(r);
+}
+
+/* conditional 'and' 'or', any integer but 0 is true. Written out in an
+   expression they are special forms that skip the second operand when they can */
+lval* builtin_con(lenv* e, lval* a, int is_and) {
+    char* op = is_and ? "and" : "or";
+    LASSERT_NUM(op, a, 2);
+    LASSERT_TYPE(op, a, 0, LVAL_LONG);
+    LASSERT_TYPE(op, a, 1, LVAL_LONG);
+
+    int p = a->cell[0]->num != 0;
+    int q = a->cell[1]->num != 0;
+    lval_del(a); return lval_long(is_and ? p & q : p | q);
+}
+
+/* conditional 'not */
+lval* builtin_not(lenv* e, lval* a) {
+    LASSERT_NUM("not", a, 1);
+    LASSERT_TYPE("not", a, 0, LVAL_LONG);
+
+    long r = !a->cell[0]->num;
+    lval_del(a);
+    return lval_long(r);
+}
+
+/* equality functions */
+lval* builtin_cmp(lenv* e, lval* a, int is_eq) {
+    LASSERT_NUM(is_eq ? "==" : "!=", a, 2);
+
+    int r = lval_eq(a->cell[0], a->cell[1]) == is_eq;
+    lval_del(a); return lval_long(r);
+}
+
+/* check the arguments of 'if' and return the chosen branch as a sexpr */
+lval* builtin_if_branch(lval* a) {
+    LASSERT_NUM("if", a, 3);
+    LASSERT_TYPE("if", a, 0, LVAL_LONG);
+    LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
+    LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
+
+    /* Take the chosen expression and mark it as evaluable */
+    lval* x;
+    if (a->cell[0]->num) {
+        /* If condition is true evaluate first expression */
+        x = lval_own(lval_pop(a, 1));
+    } else {
+        /* Otherwise evaluate second expression */
+        x = lval_own(lval_pop(a, 2));
+    }
+    x->type = LVAL_SEXPR;
+
+    lval_del(a); return x;
+}
+
+/* builtin if */
+lval* builtin_if(lenv* e, lval* a) {
+    lval* x = builtin_if_branch(a);
+    return x->type == LVAL_ERR ? x : lval_eval(e, x);
+}
+
+/* check the first clause of 'select' and return an 'if' choosing between its
+   expression and a 'select' of the other clauses */
+lval* builtin_select_branch(lval* a) {
+    LASSERT(a, a->count > 0, "No Selection Found");
+    LASSERT_TYPE("select", a, 0, LVAL_QEXPR);
+    LASSERT(a, a->cell[0]->count >= 2,
+        "Function 'select' passed a clause without an expression for argument 0.");
+
+    lval* c = a->cell[0];
+    lval* x = lval_add(lval_sexpr(), lval_fun(builtin_if));
+    lval_add(x, lval_copy(c->cell[0]));
+
+    /* an expression is the branch itself, so calls in it stay in tail position */
+    lval* then;
+    if (c->cell[1]->type == LVAL_SEXPR) {
+        then = lval_own(lval_copy(c->cell[1]));
+        then->type = LVAL_QEXPR;
+    } else {
+        then = lval_add(lval_qexpr(), lval_copy(c->cell[1]));
+    }
+    lval_add(x, then);
+
+    /* the values of the builtins are used so rebinding the symbols can't change this */
+    lval* rest = lval_qexpr();
+    if (a->count == 1) {
+        lval_add(rest, lval_err("No Selection Found"));
+    } else {
+        lval_add(rest, lval_fun(builtin_select));
+        for (int i = 1; i < a->count; i++) { lval_add(rest, lval_copy(a->cell[i])); }
+    }
+    lval_add(x, rest);
+
+    lval_del(a); return x;
+}
+
+/* builtin select */
+lval* builtin_select(lenv* e, lval* a) {
+    lval* x = builtin_select_branch(a);
+    return x->type == LVAL_ERR ? x : lval_eval(e, x);
+}
+
+/* check the argument of 'let' and return the body */
+lval* builtin_let_body(lval* a) {
+    LASSERT_NUM("let", a, 1);
+    LASSERT_TYPE("let", a, 0, LVAL_QEXPR);
+    return lval_take(a, 0);
+}
+
+/* evaluate a body in a new scope, what it puts there is gone afterwards */
+lval* builtin_let(lenv* e, lval* a) {
+    lval* x = builtin_let_body(a);
+    if (x->type == LVAL_ERR) { return x; }
+
+    lval* g = lval_scope(x);
+    lenv_link(g->env, e);
+    x = lval_own(x);
+    x->type = LVAL_SEXPR;
+    x = lval_eval(g->env, x);
+    lval_del(g); return x;
+}
+
+/* perform several things in sequence, returning the value of the last */
+lval* builtin_do(lenv* e, lval* a) {
+    if (a->count == 0) { lval_del(a); return lval_qexpr(); }
+    return lval_take(a, a->count - 1);
+}
+
+/* define builtins to insert in the environment */
+lval* builtin_add(lenv* e, lval* a) { return builtin_op(e, a, LOP_ADD); }
+lval* builtin_sub(lenv* e, lval* a) { return builtin_op(e, a, LOP_SUB); }
+lval* builtin_mul(lenv* e, lval* a) { return builtin_op(e, a, LOP_MUL); }
+lval* builtin_div(lenv* e, lval* a) { return builtin_op(e, a, LOP_DIV); }
+lval* builtin_mod(lenv* e, lval* a) { return builtin_op(e, a, LOP_MOD); }
+lval* builtin_max(lenv* e, lval* a) { return builtin_op(e, a, LOP_MAX); }
+lval* builtin_min(lenv* e, lval* a) { return builtin_op(e, a, LOP_MIN); }
+lval* builtin_pow(lenv* e, lval* a) { return builtin_op(e, a, LOP_POW); }
+lval* builtin_gt(lenv* e, lval* a) { return builtin_ord(e, a, LORD_GT); }
+lval* builtin_lt(lenv* e, lval* a) { return builtin_ord(e, a, LORD_LT); }
+lval* builtin_ge(lenv* e, lval* a) { return builtin_ord(e, a, LORD_GE); }
+lval* builtin_le(lenv* e, lval* a) { return builtin_ord(e, a, LORD_LE); }
+lval* builtin_eq(lenv* e, lval* a) { return builtin_cmp(e, a, 1); }
+lval* builtin_ne(lenv* e, lval* a) { return builtin_cmp(e, a, 0); }
+lval* builtin_and(lenv* e, lval* a) { return builtin_con(e, a, 1); }
+lval* builtin_or(lenv* e, lval* a)  { return builtin_con(e, a, 0); }
+
+
+/* Arrays */
+
+
+/* Kernels run over whole arrays of 8 byte elements. When the compiler targets
+   AVX or SSE2 the common operations are done a vector at a time, the others
+   and what is left at the end one element at a time */
+#if defined(__AVX__)
+typedef __m256d lvec;
+#define LVEC_N (4)
+#define lvec_load _mm256_loadu_pd
+#define lvec_store _mm256_storeu_pd
+#define lvec_set1 _mm256_set1_pd
+#define lvec_add _mm256_add_pd
+#define lvec_sub _mm256_sub_pd
+#define lvec_mul _mm256_mul_pd
+#define lvec_div _mm256_div_pd
+#define lvec_max _mm256_max_pd
+#define lvec_min _mm256_min_pd
+#define lvec_and _mm256_and_pd
+#define lvec_gt(x, y) _mm256_cmp_pd(x, y, _CMP_GT_OQ)
+#define lvec_lt(x, y) _mm256_cmp_pd(x, y, _CMP_LT_OQ)
+#define lvec_ge(x, y) _mm256_cmp_pd(x, y, _CMP_GE_OQ)
+#define lvec_le(x, y) _mm256_cmp_pd(x, y, _CMP_LE_OQ)
+/* an integer 1 in every lane, and-ed with a comparison it leaves 0 or 1 */
+#define lvec_one() _mm256_castsi256_pd(_mm256_set1_epi64x(1))
+#elif defined(__SSE2__)
+typedef __m128d lvec;
+#define LVEC_N (2)
+#define lvec_load _mm_loadu_pd
+#define lvec_store _mm_storeu_pd
+#define lvec_set1 _mm_set1_pd
+#define lvec_add _mm_add_pd
+#define lvec_sub _mm_sub_pd
+#define lvec_mul _mm_mul_pd
+#define lvec_div _mm_div_pd
+#define lvec_max _mm_max_pd
+#define lvec_min _mm_min_pd
+#define lvec_and _mm_and_pd
+#define lvec_gt _mm_cmpgt_pd
+#define lvec_lt _mm_cmplt_pd
+#define lvec_ge _mm_cmpge_pd
+#define lvec_le _mm_cmple_pd
+#define lvec_one() _mm_castsi128_pd(_mm_set1_epi64x(1))
+#endif
+
+/* integer lanes only add and subtract, 64 bit products need AVX-512 */
+#if defined(__AVX2__)
+typedef __m256i lveci;
+#define LVECI_N (4)
+#define lveci_load(p) _mm256_loadu_si256((__m256i*)(p))
+#define lveci_store(p, x) _mm256_storeu_si256((__m256i*)(p), x)
+#define lveci_set1 _mm256_set1_epi64x
+#define lveci_add _mm256_add_epi64
+#define lveci_sub _mm256_sub_epi64
+#elif defined(__SSE2__)
+typedef __m128i lveci;
+#define LVECI_N (2)
+#define lveci_load(p) _mm_loadu_si128((__m128i*)(p))
+#define lveci_store(p, x) _mm_storeu_si128((__m128i*)(p), x)
+#define lveci_set1 _mm_set1_epi64x
+#define lveci_add _mm_add_epi64
+#define lveci_sub _mm_sub_epi64
+#endif
+
+/* one step of an operator on two decimals */
+double lop_f64(int op, double x, double y) {
+    switch (op) {
+        case LOP_ADD: return x + y;
+        case LOP_SUB: return x - y;
+        case LOP_MUL: return x * y;
+        case LOP_DIV: return x / y;
+        case LOP_MOD: return fmod(x, y);
+        case LOP_MAX: return x < y ? y : x;
+        case LOP_MIN: return x > y ? y : x;
+        default: return pow(x, y);
+    }
+}
+
+/* one step on two integers, wrapping around on overflow. Zero divisors are
+   checked by the caller */
+int64_t lop_i64(int op, int64_t x, int64_t y) {
+    switch (op) {
+        case LOP_ADD: return (int64_t)((uint64_t)x + (uint64_t)y);
+        case LOP_SUB: return (int64_t)((uint64_t)x - (uint64_t)y);
+        case LOP_MUL: return (int64_t)((uint64_t)x * (uint64_t)y);
+        case LOP_DIV: return (y == -1) ? (int64_t)(0 - (uint64_t)x) : x / y;
+        case LOP_MOD: return (y == -1) ? 0 : x % y;
+        case LOP_MAX: return x < y ? y : x;
+        case LOP_MIN: return x > y ? y : x;
+        default: return power(x, y);
+    }
+}
+
+/* r[i] = r[i] op y[i], or y[0] for every element when step is 0.
+   Returns 0 on division by zero */
+int lkern_f64(int op, double* r, double* y, int step, int n) {
+    if (n == 0) { return 1; }
+    if ((op == LOP_DIV) | (op == LOP_MOD)) {
+        for (int i = 0; i < (step ? n : 1); i++) { if (y[i] == 0) { return 0; } }
+    }
+
+    int i = 0;
+#ifdef LVEC_N
+    lvec b = lvec_set1(y[0]);
+#define LVEC_LOOP(f) \
+    for (; i + LVEC_N <= n; i += LVEC_N) { \
+        if (step) { b = lvec_load(y + i); } \
+        lvec_store(r + i, f(lvec_load(r + i), b)); \
+    }
+    switch (op) {
+        case LOP_ADD: LVEC_LOOP(lvec_add); break;
+        case LOP_SUB: LVEC_LOOP(lvec_sub); break;
+        case LOP_MUL: LVEC_LOOP(lvec_mul); break;
+        case LOP_DIV: LVEC_LOOP(lvec_div); break;
+        case LOP_MAX: LVEC_LOOP(lvec_max); break;
+        case LOP_MIN: LVEC_LOOP(lvec_min); break;
+    }
+#undef LVEC_LOOP
+#endif
+    for (; i < n; i++) { r[i] = lop_f64(op, r[i], y[i * step]); }
+    return 1;
+}
+
+/* the same for integers */
+int lkern_i64(int op, int64_t* r, int64_t* y, int step, int n) {
+    if (n == 0) { return 1; }
+    if ((op == LOP_DIV) | (op == LOP_MOD)) {
+        for (int i = 0; i < (step ? n : 1); i++) { if (y[i] == 0) { return 0; } }
+    }
+    if (op == LOP_POW) {
+        for (int i = 0; i < n; i++) { if (r[i] == 0 && y[i * step] < 0) { return 0; } }
+    }
+
+    int i = 0;
+#ifdef LVECI_N
+    if ((op == LOP_ADD) | (op == LOP_SUB)) {
+        lveci b = lveci_set1(y[0]);
+        for (; i + LVECI_N <= n; i += LVECI_N) {
+            if (step) { b = lveci_load(y + i); }
+            lveci x = lveci_load(r + i);
+            lveci_store(r + i, op == LOP_ADD ? lveci_add(x, b) : lveci_sub(x, b));
+        }
+    }
+#endif
+    for (; i < n; i++) { r[i] = lop_i64(op, r[i], y[i * step]); }
+    return 1;
+}
+
+/* r[i] = x[i] ord y[i] (or y[0]) as 0 or 1 */
+void lkern_ord_f64(int op, int64_t* r, double* x, double* y, int step, int n) {
+    if (n == 0) { return; }
+
+    int i = 0;
+#ifdef LVEC_N
+    lvec b = lvec_set1(y[0]);
+    lvec one = lvec_one();
+#define LVEC_LOOP(f) \
+    for (; i + LVEC_N <= n; i += LVEC_N) { \
+        if (step) { b = lvec_load(y + i); } \
+        lvec_store((double*)(r + i), lvec_and(f(lvec_load(x + i), b), one)); \
+    }
+    switch (op) {
+        case LORD_GT: LVEC_LOOP(lvec_gt); break;
+        case LORD_LT: LVEC_LOOP(lvec_lt); break;
+        case LORD_GE: LVEC_LOOP(lvec_ge); break;
+        case LORD_LE: LVEC_LOOP(lvec_le); break;
+    }
+#undef LVEC_LOOP
+#endif
+    for (; i < n; i++) { r[i] = lord_double(op, x[i], y[i * step]); }
+}
+
+void lkern_ord_i64(int op, int64_t* r, int64_t* x, int64_t* y, int step, int n) {
+    for (int i = 0; i < n; i++) {
+        int64_t p = x[i], q = y[i * step];
+        switch (op) {
+            case LORD_GT: r[i] = p > q; break;
+            case LORD_LT: r[i] = p < q; break;
+            case LORD_GE: r[i] = p >= q; break;
+            default: r[i] = p <= q; break;
+        }
+    }
+}
+
+/* fold the elements with '+', '*', max or min. The last two need an element */
+double lkern_fold_f64(int op, double* x, int n) {
+    int i = 0;
+    double acc = (op == LOP_ADD) ? 0 : (op == LOP_MUL) ? 1 : x[i++];
+#ifdef LVEC_N
+    if (n - i >= 2 * LVEC_N) {
+        lvec v = lvec_load(x + i);
+        for (i += LVEC_N; i + LVEC_N <= n; i += LVEC_N) {
+            lvec y = lvec_load(x + i);
+            switch (op) {
+                case LOP_ADD: v = lvec_add(v, y); break;
+                case LOP_MUL: v = lvec_mul(v, y); break;
+                case LOP_MAX: v = lvec_max(v, y); break;
+                case LOP_MIN: v = lvec_min(v, y); break;
+            }
+        }
+        double t[LVEC_N];
+        lvec_store(t, v);
+        for (int k = 0; k < LVEC_N; k++) { acc = lop_f64(op, acc, t[k]); }
+    }
+#endif
+    for (; i < n; i++) { acc = lop_f64(op, acc, x[i]); }
+    return acc;
+}
 
-    /* bind custom name to the lambda function in the environment */
-    lval* name = lval_take(builtin_head(e, a), 0);
-    lenv_def(e, name, lambda);
+int64_t lkern_fold_i64(int op, int64_t* x, int n) {
+    int i = 0;
+    int64_t acc = (op == LOP_ADD) ? 0 : (op == LOP_MUL) ? 1 : x[i++];
+#ifdef LVECI_N
+    if (op == LOP_ADD && n >= 2 * LVECI_N) {
+        lveci v = lveci_load(x);
+        for (i = LVECI_N; i + LVECI_N <= n; i += LVECI_N) { v = lveci_add(v, lveci_load(x + i)); }
+        int64_t t[LVECI_N];
+        lveci_store(t, v);
+        for (int k = 0; k < LVECI_N; k++) { acc = lop_i64(op, acc, t[k]); }
+    }
+#endif
+    for (; i < n; i++) { acc = lop_i64(op, acc, x[i]); }
+    return acc;
+}
 
-    lval_del(lambda); lval_del(name); return lval_sexpr();
+double lkern_dot_f64(double* x, double* y, int n) {
+    int i = 0;
+    double acc = 0;
+#ifdef LVEC_N
+    if (n >= LVEC_N) {
+        lvec v = lvec_mul(lvec_load(x), lvec_load(y));
+        for (i = LVEC_N; i + LVEC_N <= n; i += LVEC_N) {
+            v = lvec_add(v, lvec_mul(lvec_load(x + i), lvec_load(y + i)));
+        }
+        double t[LVEC_N];
+        lvec_store(t, v);
+        for (int k = 0; k < LVEC_N; k++) { acc += t[k]; }
+    }
+#endif
+    for (; i < n; i++) { acc += x[i] * y[i]; }
+    return acc;
 }
 
-/* exit the program */
-lval* builtin_exit(lenv* e, lval* a) {
-    exit(0);
+int64_t lkern_dot_i64(int64_t* x, int64_t* y, int n) {
+    uint64_t acc = 0;
+    for (int i = 0; i < n; i++) { acc += (uint64_t)x[i] * (uint64_t)y[i]; }
+    return (int64_t)acc;
 }
 
-/* Use operator strings to see which operation to perform */
-lval* builtin_op(lenv* e, lval* a, char* op) {
+/* an array with the elements of 'v' as 'elem', shared when they already are */
+lval* larr_as(lval* v, int elem) {
+    if (v->elem == elem) { return lval_copy(v); }
+    lval* x = lval_array(elem, v->size);
+    for (int i = 0; i < v->size; i++) {
+        if (elem == LARR_F64) {
+            x->f64[i] = (double)v->i64[i];
+        } else {
+            x->i64[i] = (int64_t)v->f64[i];
+        }
+    }
+    return x;
+}
 
-    /* Ensure all arguments are numbers */
-    for (int i = 0; i < a->count; i++) {
-        if ((a->cell[i]->type != LVAL_LONG) & (a->cell[i]->type != LVAL_DOUBLE)) {
-            lval_del(a);
+/* an array from a Q-Expression of numbers, decimals are truncated for i64 */
+lval* larr_from_list(lval* l, int elem) {
+    lval* x = lval_array(elem, l->count);
+    for (int i = 0; i < l->count; i++) {
+        lval* y = l->cell[i];
+        if ((y->type != LVAL_LONG) & (y->type != LVAL_DOUBLE)) {
+            lval_del(x);
             return lval_err("Cannot operate on non-number!");
         }
+        if (elem == LARR_F64) {
+            x->f64[i] = lval_to_double(y);
+        } else {
+            x->i64[i] = y->type == LVAL_LONG ? y->num : (int64_t)y->dec;
+        }
     }
+    return x;
+}
 
-    /* Pop the first element */
-    lval* x = lval_pop(a, 0);
-
-    /* If no arguments and sub then perform unary negation */
-    if ((strcmp(op, "-") == 0) && a->count == 0) {
-        x->num = -x->num;
-        x->dec = -x->dec;
+/* fold an array with '+', '*', max or min into a number */
+lval* larr_fold(lval* v, int op) {
+    if (v->size == 0 && ((op == LOP_MAX) | (op == LOP_MIN))) {
+        return lval_err("Function '%s' passed an empty Array.", op == LOP_MAX ? "max" : "min");
     }
+    if (v->elem == LARR_F64) { return lval_double(lkern_fold_f64(op, v->f64, v->size)); }
+    return lval_long(lkern_fold_i64(op, v->i64, v->size));
+}
 
-    /* While there are still elements remaining */
-    while (a->count > 0) {
+/* apply an operator with an array or a number to every element of 'r' */
+int larr_apply(lval* r, int op, lval* y) {
+    if (y->type != LVAL_ARR) {
+        if (r->elem == LARR_F64) {
+            double d = lval_to_double(y);
+            return lkern_f64(op, r->f64, &d, 0, r->size);
+        }
+        int64_t n = y->num;
+        return lkern_i64(op, r->i64, &n, 0, r->size);
+    }
+    if (r->elem == LARR_I64) { return lkern_i64(op, r->i64, y->i64, 1, r->size); }
 
-        /* Pop the next element */
-        lval* y = lval_pop(a, 0);
-        /* operations for integer numbers */
-        if ((x->type == LVAL_LONG) & (y->type == LVAL_LONG)) {
+    lval* z = larr_as(y, LARR_F64);
+    int ok = lkern_f64(op, r->f64, z->f64, 1, r->size);
+    lval_del(z);
+    return ok;
+}
 
-            if (strcmp(op, "+") == 0) { x->num += y->num; }
-            if (strcmp(op, "-") == 0) { x->num -= y->num; }
-            if (strcmp(op, "*") == 0) { x->num *= y->num; }
-            if (strcmp(op, "/") == 0) {
-                if (y->num == 0) {
-                    lval_del(x); lval_del(y);
-                    x = lval_err("Division By Zero!"); break;
-                }
-                x->num /= y->num;
+/* Element-wise arithmetic for builtin_op once an argument is an array. Numbers
+   apply to every element, and any decimal makes the result an f64 array */
+lval* larr_op(lval* a, int op) {
+    int size = -1;
+    int elem = LARR_I64;
+    for (int i = 0; i < a->count; i++) {
+        lval* x = a->cell[i];
+        if (x->type == LVAL_ARR) {
+            if (size >= 0 && x->size != size) {
+                lval* err = lval_err("Arrays of different lengths. Got %i, Expected %i.",
+                    x->size, size);
+                lval_del(a); return err;
             }
-            if (strcmp(op, "%") == 0) { x->num %= y->num; }
-            if (strcmp(op, "max") == 0) { if (x->num <= y->num) { x->num = y->num; }}
-            if (strcmp(op, "min") == 0) { if (x->num >= y->num) { x->num = y->num; }}
-            if (strcmp(op, "^" ) == 0) { x->num = power(x->num, y->num); }
-
-            x->dec = x->num;
+            size = x->size;
+            if (x->elem == LARR_F64) { elem = LARR_F64; }
+        } else if (x->type == LVAL_DOUBLE) {
+            elem = LARR_F64;
+        } else if (x->type != LVAL_LONG) {
+            lval_del(a);
+            return lval_err("Cannot operate on non-number!");
         }
-        else {
-            /* operations for decimal numbers */
-            if (strcmp(op, "+") == 0) { x->dec += y->dec; }
-            if (strcmp(op, "-") == 0) { x->dec -= y->dec; }
-            if (strcmp(op, "*") == 0) { x->dec *= y->dec; }
-            if (strcmp(op, "/") == 0) {
-                if (y->dec == 0) {
-                    lval_del(x); lval_del(y);
-                    x = lval_err("Division By Zero!"); break;
-                }
-                x->dec /= y->dec;
+    }
+
+    /* max and min of a single array are its largest and smallest element */
+    if (a->count == 1 && ((op == LOP_MAX) | (op == LOP_MIN))) {
+        lval* x = larr_fold(a->cell[0], op);
+        lval_del(a); return x;
+    }
+
+    /* Start from the first argument, or from zeros to negate it */
+    lval* r = lval_array(elem, size);
+    int first = 1;
+    lval* x = a->cell[0];
+    if ((op == LOP_SUB) && a->count == 1) {
+        if (size) { memset(r->f64, 0, sizeof(double) * size); }
+        first = 0;
+    } else if (x->type == LVAL_ARR && x->elem == elem) {
+        if (size) { memcpy(r->f64, x->f64, sizeof(double) * size); }
+    } else {
+        for (int i = 0; i < size; i++) {
+            if (elem == LARR_I64) {
+                r->i64[i] = x->num;
+            } else {
+                r->f64[i] = x->type == LVAL_ARR ? larr_double(x, i) : lval_to_double(x);
             }
-            if (strcmp(op, "max") == 0) { if (x->dec <= y->dec) { x->dec = y->dec; }}
-            if (strcmp(op, "min") == 0) { if (x->dec >= y->dec) { x->dec = y->dec; }}
         }
-
-        lval_del(y);
     }
 
-    lval_del(a); return x;
+    for (int i = first; i < a->count; i++) {
+        if (!larr_apply(r, op, a->cell[i])) {
+            lval_del(r); lval_del(a);
+            return lval_err("Division By Zero!");
+        }
+    }
+    lval_del(a); return r;
 }
 
-/* conditional functions for number */
-lval* builtin_ord(lenv* e, lval* a, char* op) {
-    LASSERT_NUM(op, a, 2);
-
-    /* ensure every argument is a number */
-    if (((a->cell[0]->type != LVAL_LONG) & (a->cell[0]->type != LVAL_DOUBLE)) &
-        ((a->cell[1]->type != LVAL_LONG) & (a->cell[1]->type != LVAL_DOUBLE))) {
-        lval_del(a); return lval_err("Error, %s can only compare numbers", op);
-    }
+/* Element-wise comparison for builtin_ord, giving a mask of 0 and 1 */
+lval* larr_ord(lval* a, int op) {
+    lval* x = a->cell[0];
+    lval* y = a->cell[1];
 
-    int r;
-    if (strcmp(op, ">")  == 0) {
-        r = (a->cell[0]->dec >  a->cell[1]->dec);
+    /* keep the array on the left, '1 > a' is 'a < 1' */
+    if (x->type != LVAL_ARR) {
+        lval* t = x; x = y; y = t;
+        op ^= 1;
     }
-    if (strcmp(op, "<")  == 0) {
-        r = (a->cell[0]->dec <  a->cell[1]->dec);
+    if (y->type == LVAL_ARR && y->size != x->size) {
+        lval* err = lval_err("Arrays of different lengths. Got %i, Expected %i.",
+            y->size, x->size);
+        lval_del(a); return err;
     }
-    if (strcmp(op, ">=") == 0) {
-        r = (a->cell[0]->dec >= a->cell[1]->dec);
-    }
-    if (strcmp(op, "<=") == 0) {
-        r = (a->cell[0]->dec <= a->cell[1]->dec);
+
+    int n = x->size;
+    lval* r = lval_array(LARR_I64, n);
+    int is_f64 = x->elem == LARR_F64 ||
+        (y->type == LVAL_ARR ? y->elem == LARR_F64 : y->type == LVAL_DOUBLE);
+
+    if (is_f64) {
+        lval* xs = larr_as(x, LARR_F64);
+        if (y->type == LVAL_ARR) {
+            lval* ys = larr_as(y, LARR_F64);
+            lkern_ord_f64(op, r->i64, xs->f64, ys->f64, 1, n);
+            lval_del(ys);
+        } else {
+            double d = lval_to_double(y);
+            lkern_ord_f64(op, r->i64, xs->f64, &d, 0, n);
+        }
+        lval_del(xs);
+    } else if (y->type == LVAL_ARR) {
+        lkern_ord_i64(op, r->i64, x->i64, y->i64, 1, n);
+    } else {
+        int64_t k = y->num;
+        lkern_ord_i64(op, r->i64, x->i64, &k, 0, n);
     }
 
-    lval_del(a); return lval_long(r);
+    lval_del(a); return r;
 }
 
-/* conditional 'and' 'or' */
-lval* builtin_con(lenv* e, lval* a, char* op) {
-    LASSERT_NUM(op, a, 2);
-    LASSERT_TYPE(op, a, 1, LVAL_LONG);
-    LASSERT_TYPE(op, a, 2, LVAL_LONG);
-
-    int r = 0;
-    if (strcmp(op, "and") == 0) {
-        if ((a->cell[0]->num == 1) & (a->cell[1]->num == 1)) {
-            r = 1;
-        }
-    }
-    if (strcmp(op, "or") == 0) {
-        if ((a->cell[0]->num == 1) | (a->cell[1]->num == 1)) {
-            r = 1;
-        }
-    }
+/* convert a Q-Expression of numbers or another array */
+lval* builtin_array(lval* a, char* func, int elem) {
+    LASSERT_NUM(func, a, 1);
+    LASSERT(a, (a->cell[0]->type == LVAL_QEXPR) | (a->cell[0]->type == LVAL_ARR),
+        "Function '%s' expected a Q-expression or an Array", func);
 
-    lval_del(a); return lval_long(r);
+    lval* x = a->cell[0]->type == LVAL_ARR
+        ? larr_as(a->cell[0], elem) : larr_from_list(a->cell[0], elem);
+    lval_del(a); return x;
 }
 
-/* conditional 'not */
-lval* builtin_not(lenv* e, lval* a) {
-    LASSERT_NUM("not", a, 1);
-    LASSERT_TYPE("not", a, 0, LVAL_LONG);
+lval* builtin_i64(lenv* e, lval* a) { return builtin_array(a, "i64", LARR_I64); }
+lval* builtin_f64(lenv* e, lval* a) { return builtin_array(a, "f64", LARR_F64); }
 
-    lval* r = lval_take(a, 0);
-    r->num = !r->num;
-    r->dec = r->num;
+/* the elements of an array or a vector back in a Q-Expression */
+lval* builtin_to_list(lenv* e, lval* a) {
+    LASSERT_NUM("to-list", a, 1);
+    LASSERT(a, (a->cell[0]->type == LVAL_ARR) | (a->cell[0]->type == LVAL_VEC),
+        "Function 'to-list' expected an Array or a Vector");
 
-    return r;
+    lval* v = a->cell[0];
+    if (v->type == LVAL_VEC) {
+        lval* x = lval_vec_to_list(v);
+        lval_del(a); return x;
+    }
+    lval* x = lval_qexpr();
+    x->count = v->size;
+    x->cell = lcell_alloc(v->size);
+    for (int i = 0; i < v->size; i++) {
+        x->cell[i] = v->elem == LARR_I64 ? lval_long(v->i64[i]) : lval_double(v->f64[i]);
+    }
+    lval_del(a); return x;
 }
 
-/* equality functions */
-lval* builtin_cmp(lenv* e, lval* a, char* op) {
-    LASSERT_NUM(op, a, 2);
+/* add or multiply together the numbers in a list or an array */
+lval* builtin_fold(lval* a, char* func, int op) {
+    LASSERT_NUM(func, a, 1);
+    LASSERT(a, (a->cell[0]->type == LVAL_QEXPR) | (a->cell[0]->type == LVAL_ARR),
+        "Function '%s' expected a Q-expression or an Array", func);
 
-    int r;
-    if (strcmp(op, "==") == 0) {
-        r = lval_eq(a->cell[0], a->cell[1]);
-    }
-    else if (strcmp(op, "!=") == 0) {
-        r = !(lval_eq(a->cell[0], a->cell[1]));
+    lval* l = a->cell[0];
+    if (l->type == LVAL_ARR) {
+        lval* x = larr_fold(l, op);
+        lval_del(a); return x;
     }
 
-    lval_del(a); return lval_long(r);
+    /* Lists go through the operator, starting from its identity */
+    lval* x = lval_sexpr();
+    x->count = l->count + 1;
+    x->cell = lcell_alloc(x->count);
+    x->cell[0] = lval_long(op == LOP_MUL);
+    for (int i = 0; i < l->count; i++) { x->cell[i + 1] = lval_copy(l->cell[i]); }
+    lval_del(a);
+    return builtin_op(NULL, x, op);
 }
 
-/* builtin if */
-lval* builtin_if(lenv* e, lval* a) {
-    LASSERT_NUM("if", a, 3);
-    LASSERT_TYPE("if", a, 0, LVAL_LONG);
-    LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
-    LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
+lval* builtin_sum(lenv* e, lval* a) { return builtin_fold(a, "sum", LOP_ADD); }
+lval* builtin_product(lenv* e, lval* a) { return builtin_fold(a, "product", LOP_MUL); }
 
-    /* Mark Both Expressions as evaluable */
-    lval* x;
-    a->cell[1]->type = LVAL_SEXPR;
-    a->cell[2]->type = LVAL_SEXPR;
+/* average of the elements of an array */
+lval* builtin_mean(lenv* e, lval* a) {
+    LASSERT_NUM("mean", a, 1);
+    LASSERT_TYPE("mean", a, 0, LVAL_ARR);
+    LASSERT(a, a->cell[0]->size > 0, "Function 'mean' passed an empty Array.");
 
-    if (a->cell[0]->num) {
-        /* If condition is true evaluate first expression */
-        x = lval_eval(e, lval_pop(a, 1));
+    lval* v = larr_as(a->cell[0], LARR_F64);
+    double d = lkern_fold_f64(LOP_ADD, v->f64, v->size) / v->size;
+    lval_del(v); lval_del(a);
+    return lval_double(d);
+}
+
+/* sum of the products of the elements of two arrays */
+lval* builtin_dot(lenv* e, lval* a) {
+    LASSERT_NUM("dot", a, 2);
+    LASSERT_TYPE("dot", a, 0, LVAL_ARR);
+    LASSERT_TYPE("dot", a, 1, LVAL_ARR);
+    LASSERT(a, a->cell[0]->size == a->cell[1]->size,
+        "Arrays of different lengths. Got %i, Expected %i.",
+        a->cell[1]->size, a->cell[0]->size);
+
+    lval* x = a->cell[0];
+    lval* y = a->cell[1];
+    lval* r;
+    if ((x->elem == LARR_I64) & (y->elem == LARR_I64)) {
+        r = lval_long(lkern_dot_i64(x->i64, y->i64, x->size));
     } else {
-        /* Otherwise evaluate second expression */
-        x = lval_eval(e, lval_pop(a, 2));
+        x = larr_as(x, LARR_F64);
+        y = larr_as(y, LARR_F64);
+        r = lval_double(lkern_dot_f64(x->f64, y->f64, x->size));
+        lval_del(x); lval_del(y);
     }
-
-    lval_del(a); return x;
+    lval_del(a); return r;
 }
 
-/* define builtins to insert in the environment */
-lval* builtin_add(lenv* e, lval* a) { return builtin_op(e, a, "+"); }
-lval* builtin_sub(lenv* e, lval* a) { return builtin_op(e, a, "-"); }
-lval* builtin_mul(lenv* e, lval* a) { return builtin_op(e, a, "*"); }
-lval* builtin_div(lenv* e, lval* a) { return builtin_op(e, a, "/"); }
-lval* builtin_mod(lenv* e, lval* a) { return builtin_op(e, a, "%"); }
-lval* builtin_max(lenv* e, lval* a) { return builtin_op(e, a, "max"); }
-lval* builtin_min(lenv* e, lval* a) { return builtin_op(e, a, "min"); }
-lval* builtin_pow(lenv* e, lval* a) { return builtin_op(e, a, "^"); }
-lval* builtin_gt(lenv* e, lval* a) { return builtin_ord(e, a, ">"); }
-lval* builtin_lt(lenv* e, lval* a) { return builtin_ord(e, a, "<"); }
-lval* builtin_ge(lenv* e, lval* a) { return builtin_ord(e, a, ">="); }
-lval* builtin_le(lenv* e, lval* a) { return builtin_ord(e, a, "<="); }
-lval* builtin_eq(lenv* e, lval* a) { return builtin_cmp(e, a, "=="); }
-lval* builtin_ne(lenv* e, lval* a) { return builtin_cmp(e, a, "!="); }
-lval* builtin_and(lenv* e, lval* a) { return builtin_con(e, a, "and"); }
-lval* builtin_or(lenv* e, lval* a)  { return builtin_con(e, a, "or");  }
+/* the elements of an array where a mask of the same length is not zero */
+lval* builtin_mask(lenv* e, lval* a) {
+    LASSERT_NUM("mask", a, 2);
+    LASSERT_TYPE("mask", a, 0, LVAL_ARR);
+    LASSERT_TYPE("mask", a, 1, LVAL_ARR);
+    LASSERT(a, a->cell[0]->size == a->cell[1]->size,
+        "Arrays of different lengths. Got %i, Expected %i.",
+        a->cell[1]->size, a->cell[0]->size);
+
+    lval* m = larr_as(a->cell[0], LARR_I64);
+    lval* v = a->cell[1];
+    int n = 0;
+    for (int i = 0; i < m->size; i++) { n += m->i64[i] != 0; }
+
+    lval* x = lval_array(v->elem, n);
+    for (int i = 0, k = 0; i < m->size; i++) {
+        if (!m->i64[i]) { continue; }
+        if (v->elem == LARR_I64) { x->i64[k++] = v->i64[i]; } else { x->f64[k++] = v->f64[i]; }
+    }
+    lval_del(m); lval_del(a); return x;
+}
 
 
 /* insert functionality for user to create variables */
@@ -1352,11 +4585,636 @@ lval* builtin_var(lenv* e, lval* a, char* func) {
 lval* builtin_def(lenv* e, lval* a) { return builtin_var(e, a, "def"); }
 lval* builtin_put(lenv* e, lval* a) { return builtin_var(e, a, "="); }
 
+
+/* Bytecode */
+
+
+/* With --vm lambda bodies and top level forms are compiled for a small stack
+   machine instead of being walked as lists. Operators and special forms are still looked
+   up when they run, so rebinding them behaves as in the tree walker */
+enum {
+    OP_CONST,    /* k: push constant k */
+    OP_LOOKUP,   /* k: push the value of the symbol in constant k */
+    OP_LOCAL,    /* k slot: same, for a formal expected at a slot of the frame */
+    OP_CALL,     /* n: apply the top n values as an evaluated S-expression */
+    OP_TAILCALL, /* n: same, a lambda takes over the running frame */
+    OP_IF,       /* else end generic: branch on the top value if below it is 'if' */
+    OP_BRANCH,   /* else end: branch on a condition of 'select', errors are its value */
+    OP_JUMP,     /* to */
+    OP_RET,
+    OP_FORM,     /* form generic: pop the head, jump if it is not the builtin of the form */
+    OP_TEST,     /* form end: jump with the value of 'and' or 'or' once it is decided */
+    OP_TRUTH,    /* form: the last operand of 'and' or 'or' as 0 or 1 */
+    OP_DROP,     /* n end: pop the values 'do' discards, jump with the first error */
+    OP_TREE,     /* k: evaluate the form in constant k with the tree walker */
+    /* n: operators done in place on integers, otherwise applied as OP_CALL */
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_GT, OP_LT, OP_GE, OP_LE, OP_EQ, OP_NE
+};
+
+/* operators with their own instruction and the builtin they stand for */
+struct { char* name; int op; lbuiltin fun; } lvm_ops[] = {
+    {"+", OP_ADD, builtin_add}, {"-", OP_SUB, builtin_sub},
+    {"*", OP_MUL, builtin_mul}, {"/", OP_DIV, builtin_div},
+    {">", OP_GT, builtin_gt}, {"<", OP_LT, builtin_lt},
+    {">=", OP_GE, builtin_ge}, {"<=", OP_LE, builtin_le},
+    {"==", OP_EQ, builtin_eq}, {"!=", OP_NE, builtin_ne},
+    {NULL, 0, NULL}
+};
+
+/* special forms compiled in place, 'let' is left to the tree walker */
+lbuiltin lvm_forms[] = {
+    [LFORM_AND] = builtin_and, [LFORM_OR] = builtin_or, [LFORM_DO] = builtin_do,
+    [LFORM_SELECT] = builtin_select
+};
+
+lcode* lcode_new(void) {
+    lcode* c = calloc(1, sizeof(lcode));
+    c->rc = 1;
+    return c;
+}
+
+void lcode_del(lcode* c) {
+    if (--c->rc > 0) { return; }
+    for (int i = 0; i < c->nconst; i++) { lval_del(c->consts[i]); }
+    free(c->consts);
+    free(c->ops);
+    free(c);
+}
+
+/* append a word of code, returning where it was put */
+int lcode_emit(lcode* c, int op) {
+    if (c->count == c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 16;
+        c->ops = realloc(c->ops, sizeof(int) * c->cap);
+    }
+    c->ops[c->count] = op;
+    return c->count++;
+}
+
+/* keep a reference to a constant, returning its index */
+int lcode_const(lcode* c, lval* v) {
+    if (c->nconst == c->const_cap) {
+        c->const_cap = c->const_cap ? c->const_cap * 2 : 8;
+        c->consts = realloc(c->consts, sizeof(lval*) * c->const_cap);
+    }
+    c->consts[c->nconst] = lval_copy(v);
+    return c->nconst++;
+}
+
+/* slot a formal is bound to in the call frame, or -1, as in lval_resolve */
+int lcode_slot(lval* formals, char* sym) {
+    int slot = 0;
+    for (int i = 0; i < formals->count; i++) {
+        if (formals->cell[i]->type != LVAL_SYM) { break; }
+        if (formals->cell[i]->sym == sym_amp) { continue; }
+        if (formals->cell[i]->sym == sym) { return slot; }
+        slot++;
+    }
+    return -1;
+}
+
+/* a form left to the tree walker is kept as an S-expression, bodies are Q-Expressions */
+int lcode_tree(lcode* c, lval* v) {
+    if (v->type == LVAL_SEXPR) { return lcode_const(c, v); }
+    lval* x = lval_dup(v);
+    x->type = LVAL_SEXPR;
+    int k = lcode_const(c, x);
+    lval_del(x);
+    return k;
+}
+
+void lcode_expr(lcode* c, lval* formals, lval* x, int tail);
+
+/* true when every argument of a form is a clause {cond expr} */
+int lcode_clauses(lval* v) {
+    for (int i = 1; i < v->count; i++) {
+        if (v->cell[i]->type != LVAL_QEXPR || v->cell[i]->count != 2) { return 0; }
+    }
+    return v->count > 1;
+}
+
+/* compile the elements of a list evaluated as an S-expression */
+void lcode_sexpr(lcode* c, lval* formals, lval* v, int tail) {
+
+    /* The empty expression evaluates to itself */
+    if (v->count == 0) {
+        lval* x = lval_sexpr();
+        lcode_emit(c, OP_CONST);
+        lcode_emit(c, lcode_const(c, x));
+        lval_del(x); return;
+    }
+
+    lval* head = v->cell[0];
+
+    /* (if cond {then} {else}) runs the chosen branch without building it */
+    if (head->type == LVAL_SYM && strcmp(head->sym, "if") == 0 && v->count == 4 &&
+        v->cell[2]->type == LVAL_QEXPR && v->cell[3]->type == LVAL_QEXPR) {
+        lcode_expr(c, formals, head, 0);
+        lcode_expr(c, formals, v->cell[1], 0);
+        int at = lcode_emit(c, OP_IF);
+        lcode_emit(c, 0); lcode_emit(c, 0); lcode_emit(c, 0);
+
+        lcode_sexpr(c, formals, v->cell[2], tail);
+        lcode_emit(c, OP_JUMP);
+        int then_end = lcode_emit(c, 0);
+
+        c->ops[at+1] = c->count;
+        lcode_sexpr(c, formals, v->cell[3], tail);
+        lcode_emit(c, OP_JUMP);
+        int else_end = lcode_emit(c, 0);
+
+        /* 'if' was rebound, call whatever it is now */
+        c->ops[at+3] = c->count;
+        lcode_expr(c, formals, v->cell[2], 0);
+        lcode_expr(c, formals, v->cell[3], 0);
+        lcode_emit(c, tail ? OP_TAILCALL : OP_CALL);
+        lcode_emit(c, 4);
+
+        c->ops[at+2] = c->ops[then_end] = c->ops[else_end] = c->count;
+        return;
+    }
+
+    /* (select {cond expr} ...) tests the conditions in order like nested ifs */
+    if (head->type == LVAL_SYM && strcmp(head->sym, "select") == 0 && lcode_clauses(v)) {
+        lcode_expr(c, formals, head, 0);
+        int at = lcode_emit(c, OP_FORM);
+        lcode_emit(c, LFORM_SELECT); lcode_emit(c, 0);
+
+        /* where each clause jumps to once it is chosen or fails */
+        int* ends = malloc(sizeof(int) * 2 * v->count);
+        int n = 0;
+        for (int i = 1; i < v->count; i++) {
+            lval* cl = v->cell[i];
+            lcode_expr(c, formals, cl->cell[0], 0);
+            int br = lcode_emit(c, OP_BRANCH);
+            lcode_emit(c, 0);
+            ends[n++] = lcode_emit(c, 0);
+            lcode_expr(c, formals, cl->cell[1], tail);
+            lcode_emit(c, OP_JUMP);
+            ends[n++] = lcode_emit(c, 0);
+            c->ops[br+1] = c->count;
+        }
+
+        /* no condition was true */
+        lval* err = lval_err("No Selection Found");
+        lcode_emit(c, OP_CONST);
+        lcode_emit(c, lcode_const(c, err));
+        lval_del(err);
+        lcode_emit(c, OP_JUMP);
+        ends[n++] = lcode_emit(c, 0);
+
+        /* 'select' was rebound, evaluate the whole form as written */
+        c->ops[at+2] = c->count;
+        lcode_emit(c, OP_TREE);
+        lcode_emit(c, lcode_tree(c, v));
+
+        for (int i = 0; i < n; i++) { c->ops[ends[i]] = c->count; }
+        free(ends);
+        return;
+    }
+
+    /* (and a b), (or a b) and (do ...) only evaluate what they need */
+    int form = LFORM_NONE;
+    if (head->type == LVAL_SYM) {
+        if (strcmp(head->sym, "and") == 0 && v->count == 3) { form = LFORM_AND; }
+        if (strcmp(head->sym, "or") == 0 && v->count == 3) { form = LFORM_OR; }
+        if (strcmp(head->sym, "do") == 0 && v->count > 1) { form = LFORM_DO; }
+        if (strcmp(head->sym, "let") == 0 && v->count == 2 &&
+            v->cell[1]->type == LVAL_QEXPR) {
+            lcode_emit(c, OP_TREE);
+            lcode_emit(c, lcode_tree(c, v));
+            return;
+        }
+    }
+    if (form) {
+        lcode_expr(c, formals, head, 0);
+        int at = lcode_emit(c, OP_FORM);
+        lcode_emit(c, form); lcode_emit(c, 0);
+        int end;
+
+        if (form == LFORM_DO) {
+            for (int i = 1; i < v->count - 1; i++) {
+                lcode_expr(c, formals, v->cell[i], 0);
+            }
+            lcode_emit(c, OP_DROP);
+            lcode_emit(c, v->count - 2);
+            end = lcode_emit(c, 0);
+            lcode_expr(c, formals, v->cell[v->count-1], tail);
+        } else {
+            lcode_expr(c, formals, v->cell[1], 0);
+            lcode_emit(c, OP_TEST); lcode_emit(c, form);
+            end = lcode_emit(c, 0);
+            lcode_expr(c, formals, v->cell[2], 0);
+            lcode_emit(c, OP_TRUTH); lcode_emit(c, form);
+        }
+        lcode_emit(c, OP_JUMP);
+        int done = lcode_emit(c, 0);
+
+        /* the symbol was rebound, evaluate the whole form as written */
+        c->ops[at+2] = c->count;
+        lcode_emit(c, OP_TREE);
+        lcode_emit(c, lcode_tree(c, v));
+
+        c->ops[end] = c->ops[done] = c->count;
+        return;
+    }
+
+    /* Push the function and its arguments in order */
+    for (int i = 0; i < v->count; i++) {
+        lcode_expr(c, formals, v->cell[i], 0);
+    }
+
+    int op = tail ? OP_TAILCALL : OP_CALL;
+    if (head->type == LVAL_SYM) {
+        for (int i = 0; lvm_ops[i].name; i++) {
+            if (strcmp(head->sym, lvm_ops[i].name) == 0) { op = lvm_ops[i].op; break; }
+        }
+    }
+    lcode_emit(c, op);
+    lcode_emit(c, v->count);
+}
+
+/* compile an expression leaving its value on the stack */
+void lcode_expr(lcode* c, lval* formals, lval* x, int tail) {
+    if (x->type == LVAL_SEXPR) {
+        lcode_sexpr(c, formals, x, tail);
+        return;
+    }
+    if (x->type == LVAL_SYM) {
+        int slot = formals ? lcode_slot(formals, x->sym) : -1;
+        lcode_emit(c, slot >= 0 ? OP_LOCAL : OP_LOOKUP);
+        lcode_emit(c, lcode_const(c, x));
+        if (slot >= 0) { lcode_emit(c, slot); }
+        return;
+    }
+    /* Everything else evaluates to itself */
+    lcode_emit(c, OP_CONST);
+    lcode_emit(c, lcode_const(c, x));
+}
+
+/* compile the body of a lambda, it is evaluated as an S-expression */
+lcode* lcode_lambda(lval* f) {
+    lcode* c = lcode_new();
+    lcode_sexpr(c, f->formals, f->body, 1);
+    lcode_emit(c, OP_RET);
+    return c;
+}
+
+/* a running piece of code and the environment it runs in */
+typedef struct lframe {
+    lcode* code;
+    int ip;
+    lenv* env;
+    /* the bound lambda owning env, NULL for top level forms */
+    lval* fn;
+    /* code compiled for 'eval', released with the frame */
+    lcode* temp;
+    /* first of the lambdas kept alive by its tail calls */
+    int kept;
+} lframe;
+
+/* the value stack and frames are shared by every entry into the vm */
+struct {
+    lval** stack;
+    int sp;
+    int stack_cap;
+    lframe* frames;
+    int fp;
+    int frame_cap;
+} lvm;
+
+void lvm_push(lval* v) {
+    if (lvm.sp == lvm.stack_cap) {
+        lvm.stack_cap = lvm.stack_cap ? lvm.stack_cap * 2 : 256;
+        lvm.stack = realloc(lvm.stack, sizeof(lval*) * lvm.stack_cap);
+    }
+    lvm.stack[lvm.sp++] = v;
+}
+
+void lvm_frame(lcode* c, lenv* e, lval* fn) {
+    if (lvm.fp == lvm.frame_cap) {
+        lvm.frame_cap = lvm.frame_cap ? lvm.frame_cap * 2 : 64;
+        lvm.frames = realloc(lvm.frames, sizeof(lframe) * lvm.frame_cap);
+    }
+    lframe* fr = &lvm.frames[lvm.fp++];
+    fr->code = c;
+    fr->ip = 0;
+    fr->env = e;
+    fr->fn = fn;
+    fr->temp = NULL;
+    fr->kept = lkept.count;
+    lstack.depth++;
+}
+
+/* move the top n values into an S-expression */
+lval* lvm_pop(int n) {
+    lval* v = lval_sexpr();
+    v->cell = lcell_alloc(n);
+    v->count = n;
+    lvm.sp -= n;
+    if (n) { memcpy(v->cell, &lvm.stack[lvm.sp], sizeof(lval*) * n); }
+    return v;
+}
+
+/* integer result of an operator on n values, if it can be done in place */
+int lvm_fast(int op, lval** x, int n, long* r) {
+
+    /* it must still be the builtin and get what it is able to handle */
+    if (x[0]->type != LVAL_FUN || x[0]->builtin != lvm_ops[op - OP_ADD].fun) { return 0; }
+    if (n < 2) { return 0; }
+    if ((op == OP_EQ) | (op == OP_NE)) {
+        if ((n != 3) | (x[1]->type == LVAL_ERR) | (x[2]->type == LVAL_ERR)) { return 0; }
+        *r = lval_eq(x[1], x[2]) == (op == OP_EQ);
+        return 1;
+    }
+    for (int i = 1; i < n; i++) {
+        if (x[i]->type != LVAL_LONG) { return 0; }
+    }
+
+    /* the same kernels as the builtins, a division by zero is left to them */
+    long a = x[1]->num;
+    if (op >= OP_GT) {
+        if (n != 3) { return 0; }
+        *r = lord_long(op - OP_GT, a, x[2]->num);
+        return 1;
+    }
+    if ((op == OP_SUB) && n == 2) { a = -a; }
+    if (!lop_long(op - OP_ADD, &a, x + 2, n - 2)) { return 0; }
+    *r = a;
+    return 1;
+}
+
+/* run code until its frame returns, fn is released with the frame */
+lval* lvm_exec(lcode* code, lenv* e, lval* fn) {
+    if (lstack_full()) {
+        if (fn) { lval_del(fn); }
+        return lstack_overflow();
+    }
+
+    int entry = lvm.fp;
+    lvm_frame(code, e, fn);
+
+    for (;;) {
+        /* builtins can enter the vm again and move the frames, so never keep this */
+        lframe* fr = &lvm.frames[lvm.fp - 1];
+        int* ops = fr->code->ops;
+        int op = ops[fr->ip++];
+
+        switch (op) {
+            case OP_CONST:
+                lvm_push(lval_copy(fr->code->consts[ops[fr->ip++]]));
+            break;
+
+            case OP_LOOKUP:
+                lvm_push(lenv_get(fr->env, fr->code->consts[ops[fr->ip++]]));
+            break;
+
+            case OP_LOCAL: {
+                lval* k = fr->code->consts[ops[fr->ip++]];
+                int slot = ops[fr->ip++];
+                lenv* env = fr->env;
+                if (slot < env->count && env->syms[slot] == k->sym) {
+                    lvm_push(lval_copy(env->vals[slot]));
+                } else {
+                    lvm_push(lenv_get(env, k));
+                }
+            }
+            break;
+
+            case OP_IF: {
+                lval* f = lvm.stack[lvm.sp-2];
+                lval* x = lvm.stack[lvm.sp-1];
+                if (f->type != LVAL_FUN || f->builtin != builtin_if) {
+                    fr->ip = ops[fr->ip + 2];
+                    break;
+                }
+                lvm.sp -= 2;
+                lval_del(f);
+
+                /* errors and bad conditions are the value of the whole form */
+                if (x->type == LVAL_ERR) {
+                    lvm_push(x);
+                    fr->ip = ops[fr->ip + 1];
+                } else if (x->type != LVAL_LONG) {
+                    lvm_push(lval_err("Function 'if' passed incorrect type for argument 0. "
+                        "Got %s, Expected %s.", ltype_name(x->type), ltype_name(LVAL_LONG)));
+                    lval_del(x);
+                    fr->ip = ops[fr->ip + 1];
+                } else {
+                    fr->ip = x->num ? fr->ip + 3 : ops[fr->ip];
+                    lval_del(x);
+                }
+            }
+            break;
+
+            case OP_BRANCH: {
+                lval* x = lvm.stack[--lvm.sp];
+                if (x->type == LVAL_ERR) {
+                    lvm_push(x);
+                    fr->ip = ops[fr->ip + 1];
+                } else if (x->type != LVAL_LONG) {
+                    lvm_push(lval_err("Function 'if' passed incorrect type for argument 0. "
+                        "Got %s, Expected %s.", ltype_name(x->type), ltype_name(LVAL_LONG)));
+                    lval_del(x);
+                    fr->ip = ops[fr->ip + 1];
+                } else {
+                    fr->ip = x->num ? fr->ip + 2 : ops[fr->ip];
+                    lval_del(x);
+                }
+            }
+            break;
+
+            case OP_JUMP:
+                fr->ip = ops[fr->ip];
+            break;
+
+            case OP_FORM: {
+                int form = ops[fr->ip++];
+                lval* f = lvm.stack[--lvm.sp];
+                if (f->type != LVAL_FUN || f->builtin != lvm_forms[form]) {
+                    fr->ip = ops[fr->ip];
+                } else {
+                    fr->ip++;
+                }
+                lval_del(f);
+            }
+            break;
+
+            case OP_TEST: {
+                int is_and = ops[fr->ip++] == LFORM_AND;
+                lval* x = lvm.stack[lvm.sp-1];
+                lval* y = lform_check(is_and ? "and" : "or", x, 0);
+                if (!y && (is_and ? x->num == 0 : x->num != 0)) { y = lval_long(!is_and); }
+                if (y) {
+                    lvm.stack[lvm.sp-1] = y;
+                    fr->ip = ops[fr->ip];
+                } else {
+                    lvm.sp--;
+                    fr->ip++;
+                }
+                lval_del(x);
+            }
+            break;
+
+            case OP_TRUTH: {
+                int is_and = ops[fr->ip++] == LFORM_AND;
+                lval* x = lvm.stack[lvm.sp-1];
+                lval* y = lform_check(is_and ? "and" : "or", x, 1);
+                lvm.stack[lvm.sp-1] = y ? y : lval_long(x->num != 0);
+                lval_del(x);
+            }
+            break;
+
+            case OP_DROP: {
+                int n = ops[fr->ip++];
+                lval* err = NULL;
+                for (int i = lvm.sp - n; i < lvm.sp; i++) {
+                    if (!err && lvm.stack[i]->type == LVAL_ERR) {
+                        err = lvm.stack[i];
+                    } else {
+                        lval_del(lvm.stack[i]);
+                    }
+                }
+                lvm.sp -= n;
+                if (err) {
+                    lvm_push(err);
+                    fr->ip = ops[fr->ip];
+                } else {
+                    fr->ip++;
+                }
+            }
+            break;
+
+            case OP_TREE: {
+                lval* x = lval_copy(fr->code->consts[ops[fr->ip++]]);
+                lenv* env = fr->env;
+                lvm_push(lval_eval(env, x));
+            }
+            break;
+
+            case OP_RET: {
+                lval* x = lvm.stack[--lvm.sp];
+                lkept_release(fr->kept);
+                if (fr->fn) { lval_del(fr->fn); }
+                if (fr->temp) { lcode_del(fr->temp); }
+                lvm.fp--;
+                lstack.depth--;
+                if (lvm.fp == entry) { return x; }
+                lvm_push(x);
+            }
+            break;
+
+            case OP_CALL:
+            case OP_TAILCALL: {
+                int n = ops[fr->ip++];
+                lval* f = lvm.stack[lvm.sp - n];
+                int tail = (op == OP_TAILCALL) && fr->fn;
+
+                /* 'eval' of a Q-Expression is compiled and run in the same environment */
+                if (n == 2 && f->type == LVAL_FUN && f->builtin == builtin_eval &&
+                    lvm.stack[lvm.sp-1]->type == LVAL_QEXPR) {
+                    lval* x = lvm.stack[--lvm.sp];
+                    lvm.sp--;
+                    lval_del(f);
+
+                    lcode* c = lcode_new();
+                    lcode_sexpr(c, NULL, x, 1);
+                    lcode_emit(c, OP_RET);
+                    lval_del(x);
+
+                    if (tail) {
+                        if (fr->temp) { lcode_del(fr->temp); }
+                    } else if (lstack.depth >= lstack.limit) {
+                        lcode_del(c);
+                        lvm_push(lstack_overflow());
+                        break;
+                    } else {
+                        lvm_frame(c, fr->env, NULL);
+                        fr = &lvm.frames[lvm.fp - 1];
+                    }
+                    fr->code = fr->temp = c;
+                    fr->ip = 0;
+                    break;
+                }
+
+                /* Fully applied lambdas run in this loop rather than on the C stack */
+                int plain = (n > 1) & (f->type == LVAL_FUN) && !f->builtin;
+                for (int i = lvm.sp - n + 1; plain && i < lvm.sp; i++) {
+                    if (lvm.stack[i]->type == LVAL_ERR) { plain = 0; }
+                }
+                if (plain) {
+                    if (!f->code) { f->code = lcode_lambda(f); }
+                    lval* a = lvm_pop(n - 1);
+                    lvm.sp--;
+                    lval* g = lval_bind(f, a);
+                    lval_del(f);
+                    if (g->type == LVAL_ERR || !(g->flags & LFUN_BOUND)) {
+                        lvm_push(g);
+                        break;
+                    }
+                    lenv_link(g->env, fr->env);
+
+                    /* A tail call reuses the frame, keeping the caller's bindings alive */
+                    if (tail) {
+                        if (fr->temp) { lcode_del(fr->temp); fr->temp = NULL; }
+                        if (g->body == fr->fn->body) {
+                            lenv_rebind(fr->env, g->env);
+                            lval_del(g);
+                        } else {
+                            lkept_push(fr->fn);
+                            fr->env = g->env;
+                            fr->fn = g;
+                        }
+                        fr->code = fr->fn->code;
+                        fr->ip = 0;
+                    } else if (lstack.depth >= lstack.limit) {
+                        lval_del(g);
+                        lvm_push(lstack_overflow());
+                    } else {
+                        lvm_frame(g->code, g->env, g);
+                    }
+                    break;
+                }
+
+                /* Anything else is applied as by the tree walker */
+                lenv* env = fr->env;
+                lvm_push(lval_apply(env, lvm_pop(n)));
+            }
+            break;
+
+            default: {
+                int n = ops[fr->ip++];
+                long r;
+                if (lvm_fast(op, &lvm.stack[lvm.sp - n], n, &r)) {
+                    while (n--) { lval_del(lvm.stack[--lvm.sp]); }
+                    lvm_push(lval_long(r));
+                } else {
+                    lenv* env = fr->env;
+                    lvm_push(lval_apply(env, lvm_pop(n)));
+                }
+            }
+            break;
+        }
+    }
+}
+
+/* compile and run a top level form */
+lval* lvm_eval(lenv* e, lval* x) {
+    lcode* c = lcode_new();
+    lcode_expr(c, NULL, x, 0);
+    lcode_emit(c, OP_RET);
+    lval_del(x);
+
+    lval* r = lvm_exec(c, e, NULL);
+    lcode_del(c);
+    return r;
+}
+
 /* insert functions in the environment */
 void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
     lval* k = lval_sym(name);
     lval* v = lval_fun(func);
-    lenv_put(e, k, v);
+    lenv_def(e, k, v);
     lval_del(k); lval_del(v);
 }
 
@@ -1369,11 +5227,18 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "\\",  builtin_lambda);
     lenv_add_builtin(e, "fun",  builtin_fun);
     lenv_add_builtin(e, "exit", builtin_exit);
+    lenv_add_builtin(e, "gc",   builtin_gc);
+    lenv_add_builtin(e, "mem",  builtin_mem);
 
     /* String Functions */
     lenv_add_builtin(e, "load",  builtin_load);
     lenv_add_builtin(e, "error", builtin_error);
     lenv_add_builtin(e, "print", builtin_print);
+    lenv_add_builtin(e, "mmap", builtin_mmap);
+    lenv_add_builtin(e, "substring", builtin_substring);
+    lenv_add_builtin(e, "split-on", builtin_split_on);
+    lenv_add_builtin(e, "lines", builtin_lines);
+    lenv_add_builtin(e, "materialize", builtin_materialize);
 
     /* List Functions */
     lenv_add_builtin(e, "list", builtin_list);
@@ -1385,9 +5250,55 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "len",   builtin_len);
     lenv_add_builtin(e, "init", builtin_init);
     lenv_add_builtin(e, "index", builtin_index);
+    lenv_add_builtin(e, "vec", builtin_vec);
+    lenv_add_builtin(e, "push", builtin_push);
+    lenv_add_builtin(e, "update", builtin_update);
     lenv_add_builtin(e, "pack", builtin_pack);
     lenv_add_builtin(e, "unpack", builtin_unpack);
 
+    /* List Combinators */
+    lenv_add_builtin(e, "map", builtin_map);
+    lenv_add_builtin(e, "filter", builtin_filter);
+    lenv_add_builtin(e, "foldl", builtin_foldl);
+    lenv_add_builtin(e, "foldr", builtin_foldr);
+    lenv_add_builtin(e, "reverse", builtin_reverse);
+    lenv_add_builtin(e, "nth", builtin_nth);
+    lenv_add_builtin(e, "last", builtin_last);
+    lenv_add_builtin(e, "take", builtin_take);
+    lenv_add_builtin(e, "drop", builtin_drop);
+    lenv_add_builtin(e, "split", builtin_split);
+    lenv_add_builtin(e, "zip", builtin_zip);
+    lenv_add_builtin(e, "unzip", builtin_unzip);
+    lenv_add_builtin(e, "elem", builtin_elem);
+    lenv_add_builtin(e, "lookup", builtin_lookup);
+    lenv_add_builtin(e, "length", builtin_len);
+
+    /* Hash Map Functions */
+    lenv_add_builtin(e, "hash", builtin_hash);
+    lenv_add_builtin(e, "get", builtin_hash_get);
+    lenv_add_builtin(e, "put", builtin_hash_put);
+    lenv_add_builtin(e, "remove", builtin_hash_remove);
+    lenv_add_builtin(e, "put!", builtin_hash_put_inplace);
+    lenv_add_builtin(e, "remove!", builtin_hash_remove_inplace);
+    lenv_add_builtin(e, "has", builtin_hash_has);
+    lenv_add_builtin(e, "keys", builtin_hash_keys);
+    lenv_add_builtin(e, "values", builtin_hash_values);
+    lenv_add_builtin(e, "fold-hash", builtin_fold_hash);
+
+    /* String Builder Functions */
+    lenv_add_builtin(e, "sb", builtin_sb);
+    lenv_add_builtin(e, "sb-add", builtin_sb_add);
+    lenv_add_builtin(e, "sb-add!", builtin_sb_add_inplace);
+    lenv_add_builtin(e, "sb-str", builtin_sb_str);
+
+    /* File Functions */
+    lenv_add_builtin(e, "open", builtin_open);
+    lenv_add_builtin(e, "close", builtin_close);
+    lenv_add_builtin(e, "read-line", builtin_read_line);
+    lenv_add_builtin(e, "read-chunk", builtin_read_chunk);
+    lenv_add_builtin(e, "write", builtin_write);
+    lenv_add_builtin(e, "fold-lines", builtin_fold_lines);
+
     /* Conditionals Functions */
     lenv_add_builtin(e, ">", builtin_gt);
     lenv_add_builtin(e, "<", builtin_lt);
@@ -1396,6 +5307,9 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "==", builtin_eq);
     lenv_add_builtin(e, "!=", builtin_ne);
     lenv_add_builtin(e, "if", builtin_if);
+    lenv_add_builtin(e, "select", builtin_select);
+    lenv_add_builtin(e, "let", builtin_let);
+    lenv_add_builtin(e, "do", builtin_do);
     lenv_add_builtin(e, "and", builtin_and);
     lenv_add_builtin(e,  "or",  builtin_or);
     lenv_add_builtin(e, "not", builtin_not);
@@ -1409,11 +5323,24 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "max", builtin_max);
     lenv_add_builtin(e, "min", builtin_min);
     lenv_add_builtin(e, "^", builtin_pow);
+    lenv_add_builtin(e, "sum", builtin_sum);
+    lenv_add_builtin(e, "product", builtin_product);
+
+    /* Array Functions */
+    lenv_add_builtin(e, "i64", builtin_i64);
+    lenv_add_builtin(e, "f64", builtin_f64);
+    lenv_add_builtin(e, "to-list", builtin_to_list);
+    lenv_add_builtin(e, "mean", builtin_mean);
+    lenv_add_builtin(e, "dot", builtin_dot);
+    lenv_add_builtin(e, "mask", builtin_mask);
 }
 
 
 /* Main program where our Lisp prompt runs */
 int main(int argc, char** argv){
+    char cbase;
+    lstack.cbase = &cbase;
+
     /* Create Some Parsers */
     Number  = mpc_new("number");
     Symbol  = mpc_new("symbol");
@@ -1423,6 +5350,8 @@ int main(int argc, char** argv){
     Qexpr   = mpc_new("qexpr");
     Expr    = mpc_new("expr");
     Lispy   = mpc_new("lispy");
+    End     = mpc_new("end");
+    Form    = mpc_new("form");
 
 
     /* Define them with the following Language */
@@ -1437,26 +5366,55 @@ int main(int argc, char** argv){
         expr    : <number> | <symbol>  | <sexpr> |                  \
                   <string> | <comment> | <qexpr> ;                  \
         lispy   : /^/ <expr>* /$/ ;                                 \
+        end     : /$/ ;                                             \
+        form    : // (<expr> | <end>) ;                             \
     ",
-    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy, End, Form);
 
     /* Print Version and Exit Information */
     puts("Lispy Version 1.0.0.2");
     puts("Hi, I am Federico and this is my version of Lisp, made especially for you with love");
     puts("Press Ctrl+c or write exit to Exit\n");
 
+    /* options come before the files to run */
+    int first = 1;
+    for (; first < argc && strncmp(argv[first], "--", 2) == 0; first++) {
+        if (strcmp(argv[first], "--vm") == 0) { lvm_enabled = 1; }
+        else if (strcmp(argv[first], "--lispy-lists") == 0) { lispy_lists = 1; }
+        else if (strcmp(argv[first], "--max-depth") == 0 && first + 1 < argc &&
+            atoi(argv[first+1]) > 0) {
+            lstack.limit = atoi(argv[++first]);
+        }
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[first]);
+            return -1;
+        }
+    }
+
+    /* preallocate the shared small integers */
+    lfix_init();
+
+    /* intern the symbols the evaluator checks for */
+    sym_amp = lsym_intern("&");
+
     /* initialize the environment and load std library */
     lenv* e = lenv_new();
     lenv_add_builtins(e);
     lval* standard = lval_add(lval_sexpr(), lval_str("std-library/std_library.lspy"));
     lval* std = builtin_load(e, standard);
+
+    /* the list builtins can be replaced by their versions written in Lispy */
+    if (lispy_lists) {
+        lval* lists = lval_add(lval_sexpr(), lval_str("std-library/std_lists.lspy"));
+        lval_del(builtin_load(e, lists));
+    }
     if (atexit(cleanup)) {
       fputs("Can't register cleanup function\n", stderr);
       return -1;
     }
 
     /* if only one argument is provided start a never ending loop */
-    if (argc == 1) {
+    if (first == argc) {
         while (1) {
 
             /* Output our prompt and get input*/
@@ -1477,10 +5435,14 @@ int main(int argc, char** argv){
             if (mpc_parse("<stdin>", input, Lispy, &r)) {
 
                 /* Evaluate the operation and then do it in C */
-                lval* x = lval_eval(e, lval_read(r.output));
+                lval* y = lval_read(r.output);
+                lval* x = lvm_enabled ? lvm_eval(e, y) : lval_eval(e, y);
                 lval_println(x);
                 lval_del(x);
                 mpc_ast_delete(r.output);
+
+                /* finish reclaiming while waiting for the next input */
+                lgc_collect();
             }
             else {
                 /* Otherwise Print the Error */
@@ -1493,16 +5455,22 @@ int main(int argc, char** argv){
     }
 
     /* instead if supplied with list of files */
-    if (argc >= 2) {
+    else {
 
-        /* loop over each supplied filename (starting from 1) */
-        for (int i = 1; i < argc; i++) {
+        /* loop over each supplied filename */
+        for (int i = first; i < argc; i++) {
 
-            /* Argument list with a single argument, the filename */
-            lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
+            /* '-' runs what is piped in */
+            lval* x;
+            if (strcmp(argv[i], "-") == 0) {
+                x = lval_load_pipe(e, "<stdin>", stdin);
+            } else {
+                /* Argument list with a single argument, the filename */
+                lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
 
-            /* Pass to builtin load and get the result */
-            lval* x = builtin_load(e, args);
+                /* Pass to builtin load and get the result */
+                x = builtin_load(e, args);
+            }
 
             /* If the result is an error be sure to print it */
             if (x->type == LVAL_ERR) { lval_println(x); }
@@ -1511,7 +5479,7 @@ int main(int argc, char** argv){
     }
 
     /* Undefine and Delete our Parsers and env before exiting the code */
-    mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr,  Qexpr,  Expr, Lispy);
+    mpc_cleanup(10, Number, Symbol, String, Comment, Sexpr,  Qexpr,  Expr, Lispy, End, Form);
 
-    lval_del(std); lenv_del(e); return 0;
+    lval_del(std); lenv_del(e); lgc_collect(); return 0;
 }
@@ -35,21 +35,24 @@ static mpc_state_t mpc_state_new(void) {
 ** The cursor can jump around at will making
 ** backtracking easy.
 **
-** The second is a File which is also somewhat
-** easy. The contents are never loaded into
-** memory but backtracking can still be achieved
-** by seeking in the file at different positions.
+** The second is a File which is just as easy.
+** It is read to the end into a buffer up front
+** and then scanned through like a String, rather
+** than reading and seeking the file a character
+** at a time.
 **
 ** The final mode is Pipe. This is the difficult
-** one. As we assume pipes cannot be seeked - and
-** only support a single character lookahead at
-** any point, when the input is marked for a
-** potential backtracking we start buffering any
-** input.
+** one. As we assume pipes cannot be seeked, the
+** input is read a line at a time into a ring
+** buffer and scanned through from there.
 **
-** This means that if we are requested to seek
-** back we can simply start reading from the
-** buffer instead of the input.
+** Only what an earlier mark may still seek back
+** to is kept, older input is overwritten by new
+** lines and the buffer grows when every byte in
+** it may still be needed. Parsing a pipe one
+** statement at a time with `mpc_parse_input`
+** therefore only keeps about as much of it as
+** the longest statement.
 **
 ** Of course using `mpc_predictive` will disable
 ** backtracking and make LL(1) grammars easy
@@ -59,7 +62,6 @@ static mpc_state_t mpc_state_new(void) {
 
 enum {
   MPC_INPUT_STRING = 0,
-  MPC_INPUT_FILE   = 1,
   MPC_INPUT_PIPE   = 2
 };
 
@@ -71,11 +73,15 @@ enum {
   MPC_INPUT_MEM_NUM = 512
 };
 
+enum {
+  MPC_INPUT_PIPE_MIN = 4096
+};
+
 typedef struct {
   char mem[64];
 } mpc_mem_t;
 
-typedef struct {
+struct mpc_input_t {
 
   int type;
   char *filename;
@@ -85,6 +91,10 @@ typedef struct {
   char *buffer;
   FILE *file;
 
+  /* pipes keep positions up to buffer_end at buffer[pos % buffer_slots] */
+  long buffer_end;
+  size_t buffer_slots;
+
   int suppress;
   int backtrack;
   int marks_slots;
@@ -98,7 +108,7 @@ typedef struct {
   char mem_full[MPC_INPUT_MEM_NUM];
   mpc_mem_t mem[MPC_INPUT_MEM_NUM];
 
-} mpc_input_t;
+};
 
 static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
 
@@ -114,6 +124,8 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   strcpy(i->string, string);
   i->buffer = NULL;
   i->file = NULL;
+  i->buffer_end = 0;
+  i->buffer_slots = 0;
 
   i->suppress = 0;
   i->backtrack = 1;
@@ -144,6 +156,8 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   i->string[length] = '\0';
   i->buffer = NULL;
   i->file = NULL;
+  i->buffer_end = 0;
+  i->buffer_slots = 0;
 
   i->suppress = 0;
   i->backtrack = 1;
@@ -160,7 +174,7 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
 
 }
 
-static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
+mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
 
@@ -171,8 +185,10 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->state = mpc_state_new();
 
   i->string = NULL;
-  i->buffer = NULL;
+  i->buffer = malloc(MPC_INPUT_PIPE_MIN);
   i->file = pipe;
+  i->buffer_end = 0;
+  i->buffer_slots = MPC_INPUT_PIPE_MIN;
 
   i->suppress = 0;
   i->backtrack = 1;
@@ -192,15 +208,27 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
 static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
+  size_t len = 0, cap = 4096, n;
 
   i->filename = malloc(strlen(filename) + 1);
   strcpy(i->filename, filename);
-  i->type = MPC_INPUT_FILE;
+  i->type = MPC_INPUT_STRING;
   i->state = mpc_state_new();
 
-  i->string = NULL;
+  /* Read the rest of the file, it is then parsed as a string */
+  i->string = malloc(cap);
+  while ((n = fread(i->string + len, 1, cap - len - 1, file)) > 0) {
+    len += n;
+    if (len == cap - 1) {
+      cap *= 2;
+      i->string = realloc(i->string, cap);
+    }
+  }
+  i->string[len] = '\0';
   i->buffer = NULL;
-  i->file = file;
+  i->file = NULL;
+  i->buffer_end = 0;
+  i->buffer_slots = 0;
 
   i->suppress = 0;
   i->backtrack = 1;
@@ -216,7 +244,7 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   return i;
 }
 
-static void mpc_input_delete(mpc_input_t *i) {
+void mpc_input_delete(mpc_input_t *i) {
 
   free(i->filename);
 
@@ -313,14 +341,9 @@ static void mpc_input_mark(mpc_input_t *i) {
   i->marks[i->marks_num-1] = i->state;
   i->lasts[i->marks_num-1] = i->last;
 
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
-  }
-
 }
 
 static void mpc_input_unmark(mpc_input_t *i) {
-  int j;
 
   if (i->backtrack < 1) { return; }
 
@@ -335,14 +358,6 @@ static void mpc_input_unmark(mpc_input_t *i) {
     i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);
   }
 
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    for (j = strlen(i->buffer) - 1; j >= 0; j--)
-      ungetc(i->buffer[j], i->file);
-
-    free(i->buffer);
-    i->buffer = NULL;
-  }
-
 }
 
 static void mpc_input_rewind(mpc_input_t *i) {
@@ -352,115 +367,70 @@ static void mpc_input_rewind(mpc_input_t *i) {
   i->state = i->marks[i->marks_num-1];
   i->last  = i->lasts[i->marks_num-1];
 
-  if (i->type == MPC_INPUT_FILE) {
-    fseek(i->file, i->state.pos, SEEK_SET);
-  }
-
   mpc_input_unmark(i);
 }
 
-static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
-}
-
-static char mpc_input_buffer_get(mpc_input_t *i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
+static char mpc_input_buffer_get(mpc_input_t *i, long pos) {
+  return i->buffer[(size_t)pos & (i->buffer_slots - 1)];
 }
 
-static char mpc_input_getc(mpc_input_t *i) {
-
-  char c = '\0';
+static int mpc_input_buffer_fill(mpc_input_t *i) {
 
-  switch (i->type) {
+  long keep = i->state.pos;
+  size_t slots;
+  char *buffer;
+  long j;
+  int c;
 
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
-    case MPC_INPUT_FILE: c = fgetc(i->file); return c;
-    case MPC_INPUT_PIPE:
+  if (i->marks_num > 0 && i->marks[0].pos < keep) { keep = i->marks[0].pos; }
 
-      if (!i->buffer) { c = getc(i->file); return c; }
+  /* Grow when every byte held may still be rewound to */
+  if ((size_t)(i->buffer_end - keep) == i->buffer_slots) {
+    slots = i->buffer_slots * 2;
+    buffer = malloc(slots);
+    for (j = keep; j < i->buffer_end; j++) {
+      buffer[(size_t)j & (slots - 1)] = mpc_input_buffer_get(i, j);
+    }
+    free(i->buffer);
+    i->buffer = buffer;
+    i->buffer_slots = slots;
+  }
 
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        c = mpc_input_buffer_get(i);
-        return c;
-      } else {
-        c = getc(i->file);
-        return c;
-      }
+  /* Read up to the end of a line so an interactive pipe isn't waited on */
+  do {
+    c = getc(i->file);
+    if (c == EOF) { break; }
+    i->buffer[(size_t)i->buffer_end & (i->buffer_slots - 1)] = (char)c;
+    i->buffer_end++;
+  } while (c != '\n' && (size_t)(i->buffer_end - keep) < i->buffer_slots);
 
-    default: return c;
-  }
+  return i->buffer_end > i->state.pos;
 }
 
-static char mpc_input_peekc(mpc_input_t *i) {
-
-  char c = '\0';
+static char mpc_input_getc(mpc_input_t *i) {
 
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
-    case MPC_INPUT_FILE:
-
-      c = fgetc(i->file);
-      if (feof(i->file)) { return '\0'; }
-
-      fseek(i->file, -1, SEEK_CUR);
-      return c;
 
+    case MPC_INPUT_STRING: return i->string[i->state.pos];
     case MPC_INPUT_PIPE:
 
-      if (!i->buffer) {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        return mpc_input_buffer_get(i);
-      } else {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
+      if (i->state.pos == i->buffer_end && !mpc_input_buffer_fill(i)) { return '\0'; }
+      return mpc_input_buffer_get(i, i->state.pos);
 
-    default: return c;
+    default: return '\0';
   }
+}
 
+static char mpc_input_peekc(mpc_input_t *i) {
+  return mpc_input_getc(i);
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
   return mpc_input_peekc(i) == '\0';
 }
 
-static int mpc_input_failure(mpc_input_t *i, char c) {
-
-  switch (i->type) {
-    case MPC_INPUT_STRING: { break; }
-    case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
-    case MPC_INPUT_PIPE: {
-
-      if (!i->buffer) { ungetc(c, i->file); break; }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        break;
-      } else {
-        ungetc(c, i->file);
-      }
-    }
-    default: { break; }
-  }
-  return 0;
-}
-
 static int mpc_input_success(mpc_input_t *i, char c, char **o) {
 
-  if (i->type == MPC_INPUT_PIPE
-  &&  i->buffer && !mpc_input_buffer_in_range(i)) {
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
-  }
-
   i->last = c;
   i->state.pos++;
   i->state.col++;
@@ -490,35 +460,35 @@ static int mpc_input_char(mpc_input_t *i, char c, char **o) {
   char x;
   if (mpc_input_terminated(i)) { return 0; }
   x = mpc_input_getc(i);
-  return x == c ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
+  return x == c ? mpc_input_success(i, x, o) : 0;
 }
 
 static int mpc_input_range(mpc_input_t *i, char c, char d, char **o) {
   char x;
   if (mpc_input_terminated(i)) { return 0; }
   x = mpc_input_getc(i);
-  return x >= c && x <= d ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
+  return x >= c && x <= d ? mpc_input_success(i, x, o) : 0;
 }
 
 static int mpc_input_oneof(mpc_input_t *i, const char *c, char **o) {
   char x;
   if (mpc_input_terminated(i)) { return 0; }
   x = mpc_input_getc(i);
-  return strchr(c, x) != 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
+  return strchr(c, x) != 0 ? mpc_input_success(i, x, o) : 0;
 }
 
 static int mpc_input_noneof(mpc_input_t *i, const char *c, char **o) {
   char x;
   if (mpc_input_terminated(i)) { return 0; }
   x = mpc_input_getc(i);
-  return strchr(c, x) == 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
+  return strchr(c, x) == 0 ? mpc_input_success(i, x, o) : 0;
 }
 
 static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
   char x;
   if (mpc_input_terminated(i)) { return 0; }
   x = mpc_input_getc(i);
-  return cond(x) ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
+  return cond(x) ? mpc_input_success(i, x, o) : 0;
 }
 
 static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
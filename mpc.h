@@ -65,12 +65,19 @@ typedef union {
 struct mpc_parser_t;
 typedef struct mpc_parser_t mpc_parser_t;
 
+struct mpc_input_t;
+typedef struct mpc_input_t mpc_input_t;
+
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
 int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
 
+mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe);
+int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r);
+void mpc_input_delete(mpc_input_t *i);
+
 /*
 ** Function Types
 */